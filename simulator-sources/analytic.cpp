@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2009 The Trustees of Indiana University and Indiana
+ *                    University Research and Technology
+ *                    Corporation.  All rights reserved.
+ *
+ * Author(s): Timo Schneider <timoschn@cs.indiana.edu>
+ *            Torsten Hoefler <htor@cs.indiana.edu>
+ *
+ */
+
+/* Exact link load statistics for the rand pattern.
+ *
+ * The rand pattern is a random permutation of the ranks without fixed
+ * points (a derangement), and the ranks are placed on the hosts of the
+ * shuffled namelist. genptrn_rand draws every derangement with the same
+ * probability, so every ordered pair of hosts is equally likely to
+ * communicate, and the joint probability of two pairs only depends on how
+ * they overlap: the same source or the same destination (impossible), the
+ * reverse pair, a chain a -> b -> d or four different hosts. The load of a link is the number of communicating pairs
+ * whose route uses it, so its mean and variance follow from a handful of
+ * per-link sums over the routes of all host pairs (link_pair_stats_t),
+ * without any sampling. Only the maximum over all links still needs the
+ * simulation, the per-link moments give bounds for it.
+ *
+ * The sums are read from the route trees (get_tree_link_pair_stats). The
+ * route of a host starts with its uplink and continues in the tree of the
+ * destination from the switch of the host, so all hosts of a switch share
+ * their routes except for the uplink. The sums over the sources are
+ * therefore taken per switch, walking the tree paths from the switch to
+ * every host once, and the sums over the destinations are subtree counts
+ * in the tree of each destination. Fabrics the trees can not describe
+ * (see get_tree_link_pair_stats) route every pair with find_route.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <cgraph.h>
+#include <mpi.h>
+#include "simulator.hpp"
+#include "topology.hpp"
+#include "routing.hpp"
+#include "analytic.hpp"
+
+/* Routes all pairs that start at the hosts namelist[first .. first+count-1]
+ * (and all pairs that end there) and adds them to stats */
+void get_link_pair_stats(IN namelist_t *namelist, IN int first, IN int count, OUT link_pair_stats_t *stats) {
+	int num_edges = get_num_edges();
+	std::vector<int> out(num_edges, 0), in(num_edges, 0);
+	std::vector<unsigned int> stamp(num_edges, 0);
+	std::vector<edgeid_t> touched;
+	unsigned int epoch = 0;
+	int i, j;
+
+	stats->pairs.assign(num_edges, 0);
+	stats->out_sq.assign(num_edges, 0);
+	stats->in_sq.assign(num_edges, 0);
+	stats->in_out.assign(num_edges, 0);
+	stats->reverse.assign(num_edges, 0);
+
+	for (i = first; i < first + count; i++) {
+		hostid_t x = namelist->at(i);
+
+		/* the pairs x -> b and b -> x, the pair b -> x is counted in
+		 * reverse if the route x -> b used the same link */
+		touched.clear();
+		for (j = 0; j < (int) namelist->size(); j++) {
+			hostid_t b = namelist->at(j);
+			uroute_t route, back;
+			uroute_t::iterator iter;
+
+			if (b == x) continue;
+			epoch++;
+			find_route(&route, x, b);
+			for (iter = route.begin(); iter != route.end(); ++iter) {
+				if ((out[*iter] == 0) && (in[*iter] == 0)) touched.push_back(*iter);
+				out[*iter]++;
+				stamp[*iter] = epoch;
+			}
+			find_route(&back, b, x);
+			for (iter = back.begin(); iter != back.end(); ++iter) {
+				if ((out[*iter] == 0) && (in[*iter] == 0)) touched.push_back(*iter);
+				in[*iter]++;
+				if (stamp[*iter] == epoch) stats->reverse[*iter]++;
+			}
+		}
+
+		for (std::vector<edgeid_t>::iterator iter = touched.begin(); iter != touched.end(); ++iter) {
+			double o = out[*iter], n = in[*iter];
+
+			stats->pairs[*iter] += o;
+			stats->out_sq[*iter] += o * o;
+			stats->in_sq[*iter] += n * n;
+			stats->in_out[*iter] += o * n;
+			out[*iter] = 0;
+			in[*iter] = 0;
+		}
+	}
+}
+
+/* Stores the edges of the route from the switch sw to the host dst in the
+ * tree of dst in path and returns their number, sw has to reach dst */
+static inline int get_tree_path(int sw, hostid_t dst, edgeid_t *path) {
+	size_t base = (size_t) dst * myroutetrees.num_switches;
+	int len = myroutetrees.hops[base + sw];
+
+	for (int h = 0; h < len; h++) {
+		path[h] = myroutetrees.next[base + sw];
+		sw = mytopology.switch_index[mytopology.edge_head[path[h]]];
+	}
+	return len;
+}
+
+bool get_tree_link_pair_stats(IN namelist_t *namelist, IN int mynode, IN int allnodes, OUT link_pair_stats_t *stats) {
+	int num_switches = myroutetrees.num_switches;
+	int num_edges = get_num_edges();
+	double N = namelist->size();
+	std::vector<int> host_switch(namelist->size());
+	std::vector<int> size(num_switches, 0);             /* switch id -> namelist hosts attached */
+	std::vector<int> offset(num_switches + 1, 0);
+	std::vector<hostid_t> hosts(namelist->size());      /* namelist hosts by switch */
+	std::vector<int> leaves;                            /* switches with namelist hosts */
+	size_t i;
+	int sw;
+
+	if (myroutetrees.next.empty())
+		return false;
+
+	/* every host needs a single uplink to a switch ... */
+	for (i = 0; i < namelist->size(); i++) {
+		nodeid_t node = mytopology.host_node[namelist->at(i)];
+		edgeid_t up = mytopology.fwd_uniform[node];
+
+		if ((mytopology.fwd_offset[node] >= 0) || (up < 0) || (mytopology.switch_index[mytopology.edge_head[up]] < 0))
+			return false;
+		host_switch[i] = mytopology.switch_index[mytopology.edge_head[up]];
+		size[host_switch[i]]++;
+	}
+	for (sw = 0; sw < num_switches; sw++) {
+		offset[sw + 1] = offset[sw] + size[sw];
+		if (size[sw] > 0) leaves.push_back(sw);
+	}
+	std::vector<int> fill(offset.begin(), offset.end() - 1);
+	for (i = 0; i < namelist->size(); i++)
+		hosts[fill[host_switch[i]]++] = namelist->at(i);
+
+	/* ... and every switch with hosts has to reach every host in the trees */
+	for (i = 0; i < hosts.size(); i++)
+		for (size_t l = 0; l < leaves.size(); l++)
+			if (myroutetrees.hops[(size_t) hosts[i] * num_switches + leaves[l]] == ROUTE_TREE_BROKEN)
+				return false;
+
+	stats->pairs.assign(num_edges, 0);
+	stats->out_sq.assign(num_edges, 0);
+	stats->in_sq.assign(num_edges, 0);
+	stats->in_out.assign(num_edges, 0);
+	stats->reverse.assign(num_edges, 0);
+
+	/* the switches with hosts are split among the processes */
+	size_t myn = leaves.size() / allnodes;
+	size_t mystart = myn * mynode;
+	if (mynode == allnodes - 1) myn = leaves.size() - mystart;
+
+	std::vector<int> through(num_edges, 0), to_leaf(num_edges, 0), in(num_switches);
+	std::vector<unsigned int> stamp(num_edges, 0);
+	std::vector<edgeid_t> touched, leaf_touched;
+	std::vector<int> bucket(ROUTE_TREE_BROKEN + 1), order(num_switches);
+	edgeid_t path[ROUTE_TREE_BROKEN];
+	unsigned int epoch = 0;
+	int len, h;
+
+	for (size_t l = mystart; l < mystart + myn; l++) {
+		int s = leaves[l];
+
+		/* through[e]: the hosts whose route from s uses e. to_leaf[e] counts
+		 * the hosts of one switch t, the pairs x -> b (x on s, b on t) whose
+		 * reverse route uses e as well are those with e on the route from t
+		 * to x; the pair x -> x does not count. */
+		for (size_t m = 0; m < leaves.size(); m++) {
+			int t = leaves[m];
+			int k;
+
+			for (k = offset[t]; k < offset[t + 1]; k++) {
+				len = get_tree_path(s, hosts[k], path);
+				for (h = 0; h < len; h++) {
+					if (through[path[h]] == 0) touched.push_back(path[h]);
+					if (to_leaf[path[h]] == 0) leaf_touched.push_back(path[h]);
+					through[path[h]]++;
+					to_leaf[path[h]]++;
+				}
+			}
+			for (k = offset[s]; k < offset[s + 1]; k++) {
+				len = get_tree_path(t, hosts[k], path);
+				for (h = 0; h < len; h++)
+					stats->reverse[path[h]] += to_leaf[path[h]] - ((t == s) ? 1 : 0);
+			}
+			for (std::vector<edgeid_t>::iterator iter = leaf_touched.begin(); iter != leaf_touched.end(); ++iter)
+				to_leaf[*iter] = 0;
+			leaf_touched.clear();
+		}
+
+		/* all hosts x of s send to the same hosts, except to themselves */
+		for (std::vector<edgeid_t>::iterator iter = touched.begin(); iter != touched.end(); ++iter) {
+			double o = through[*iter];
+
+			stats->pairs[*iter] += size[s] * o;
+			stats->out_sq[*iter] += size[s] * o * o;
+		}
+		for (int k = offset[s]; k < offset[s + 1]; k++) {
+			hostid_t x = hosts[k];
+			edgeid_t up = mytopology.fwd_uniform[mytopology.host_node[x]];
+			size_t base = (size_t) x * num_switches;
+
+			epoch++;
+			len = get_tree_path(s, x, path);
+			for (h = 0; h < len; h++) {
+				stamp[path[h]] = epoch;
+				stats->pairs[path[h]] -= 1;
+				stats->out_sq[path[h]] += 1 - 2.0 * through[path[h]];
+			}
+
+			/* the uplink of x carries its N-1 pairs, and one pair towards
+			 * every other destination */
+			stats->pairs[up] += N - 1;
+			stats->out_sq[up] += (N - 1) * (N - 1);
+			stats->in_sq[up] += N - 1;
+
+			/* the pairs towards x: the sources below each switch of the
+			 * tree of x, pushed towards x in order of decreasing distance */
+			bucket.assign(ROUTE_TREE_BROKEN + 1, 0);
+			for (sw = 0; sw < num_switches; sw++) {
+				in[sw] = size[sw] - ((sw == s) ? 1 : 0);
+				bucket[myroutetrees.hops[base + sw]]++;
+			}
+			int reached = 0;
+			for (h = ROUTE_TREE_BROKEN - 1; h >= 0; h--) {
+				int count = bucket[h];
+
+				bucket[h] = reached;
+				reached += count;
+			}
+			for (sw = 0; sw < num_switches; sw++)
+				if (myroutetrees.hops[base + sw] != ROUTE_TREE_BROKEN)
+					order[bucket[myroutetrees.hops[base + sw]]++] = sw;
+			for (int j = 0; j < reached; j++) {
+				edgeid_t e;
+				double n;
+
+				sw = order[j];
+				if (in[sw] == 0) continue;
+				e = myroutetrees.next[base + sw];
+				n = in[sw];
+				stats->in_sq[e] += n * n;
+				stats->in_out[e] += n * (through[e] - ((stamp[e] == epoch) ? 1 : 0));
+				if (mytopology.edge_head[e] != mytopology.host_node[x])
+					in[mytopology.switch_index[mytopology.edge_head[e]]] += in[sw];
+			}
+		}
+
+		for (std::vector<edgeid_t>::iterator iter = touched.begin(); iter != touched.end(); ++iter)
+			through[*iter] = 0;
+		touched.clear();
+	}
+	return true;
+}
+
+/* D(m)/m!, where D(m) is the number of derangements of m elements */
+static double derangement_fraction(int m) {
+	double sum = 0, term = 1;
+
+	for (int i = 0; i <= m; i++) {
+		sum += term;
+		term *= -1.0 / (i + 1);
+	}
+	return sum;
+}
+
+/* n (n-1) ... (n-k+1) */
+static double falling(double n, int k) {
+	double result = 1;
+
+	for (int i = 0; i < k; i++)
+		result *= n - i;
+	return result;
+}
+
+/* orders edges by expected load (highest first), then by id */
+struct mean_before {
+	std::vector<double> *mean;
+
+	bool operator()(edgeid_t a, edgeid_t b) const {
+		return ((*mean)[a] != (*mean)[b]) ? ((*mean)[a] > (*mean)[b]) : (a < b);
+	}
+};
+
+void analytic_rand_loads(IN cmdargs_t *cmdargs, IN namelist_t *namelist, FILE *fd, int mynode, int allnodes) {
+	static const char *tier_names[LINK_TIERS] = {"host links", "leaf up-links", "spine links"};
+	link_pair_stats_t stats;
+	int n = cmdargs->args_info.commsize_arg;
+	double N = namelist->size();
+	int num_edges = get_num_edges();
+	double ratio[5];
+	int k, e;
+
+	if (!get_tree_link_pair_stats(namelist, mynode, allnodes, &stats)) {
+		/* the hosts are split among the processes */
+		int myn = namelist->size() / allnodes;
+		int mystart = myn * mynode;
+		if (mynode == allnodes - 1) myn = namelist->size() - mystart;
+
+		get_link_pair_stats(namelist, mystart, myn, &stats);
+	}
+	if (allnodes > 1) {
+		std::vector<double> *sums[5] = {&stats.pairs, &stats.out_sq, &stats.in_sq, &stats.in_out, &stats.reverse};
+		std::vector<double> buffer(num_edges);
+
+		for (k = 0; k < 5; k++) {
+			if (num_edges == 0) break;
+			MPI_Allreduce(&(*sums[k])[0], &buffer[0], num_edges, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+			sums[k]->swap(buffer);
+		}
+	}
+	if (mynode != 0)
+		return;
+
+	/* D(n-k)/D(n) */
+	for (k = 0; k < 5; k++)
+		ratio[k] = derangement_fraction(n - k) / (derangement_fraction(n) * falling(n, k));
+
+	/* the probability that the hosts of one pair, of the reverse pair, of a
+	 * chain of two pairs or of two pairs without a common host all take
+	 * part in the communicator and that their ranks communicate */
+	double p_pair = falling(n, 2) / falling(N, 2) * (ratio[1] + ratio[2]);
+	double p_reverse = falling(n, 2) / falling(N, 2) * ratio[2];
+	double p_chain = falling(n, 3) / falling(N, 3) * (ratio[2] + ratio[3]);
+	double p_disjoint = falling(n, 4) / falling(N, 4) * (ratio[2] + 2 * ratio[3] + ratio[4]);
+
+	std::vector<double> mean(num_edges), var(num_edges);
+	std::vector<edgeid_t> top;
+	int links[LINK_TIERS] = {0}, used[LINK_TIERS] = {0};
+	double tier_sum[LINK_TIERS] = {0}, tier_max[LINK_TIERS] = {0}, tier_sigma[LINK_TIERS] = {0};
+	double max_mean = 0;
+
+	for (e = 0; e < num_edges; e++) {
+		double c = stats.pairs[e], r = stats.reverse[e];
+		double chains = 2 * (stats.in_out[e] - r);
+		double disjoint = c * c + c - stats.out_sq[e] - stats.in_sq[e] + r - 2 * stats.in_out[e];
+		int tier = mytopology.edge_tier[e];
+
+		mean[e] = p_pair * c;
+		var[e] = p_pair * c + p_reverse * r + p_chain * chains + p_disjoint * disjoint - mean[e] * mean[e];
+		if (var[e] < 0) var[e] = 0;   /* rounding */
+
+		links[tier]++;
+		if (c > 0) {
+			used[tier]++;
+			top.push_back(e);
+		}
+		tier_sum[tier] += mean[e];
+		tier_max[tier] = std::max(tier_max[tier], mean[e]);
+		tier_sigma[tier] = std::max(tier_sigma[tier], sqrt(var[e]));
+		max_mean = std::max(max_mean, mean[e]);
+	}
+
+	/* The smallest load t that the maximum over all links exceeds with a
+	 * probability of at most 1/2, by the union bound over the one-sided
+	 * Chebyshev (Cantelli) bounds P(L >= t) <= var / (var + (t - mean)^2).
+	 * No link can carry more than the n pairs of the pattern. */
+	int bound = (int) ceil(max_mean);
+	double prob;
+	for (;; bound++) {
+		prob = 0;
+		if (bound > n) break;
+		for (e = 0; (e < num_edges) && (prob <= 0.5); e++) {
+			if (stats.pairs[e] == 0) continue;
+			if (bound <= mean[e]) prob += 1;
+			else prob += var[e] / (var[e] + (bound - mean[e]) * (bound - mean[e]));
+		}
+		if (prob <= 0.5) break;
+	}
+
+	fprintf(fd, "\nAnalytic Link Loads (rand pattern: a uniformly random derangement of %d ranks on %.0f hosts)\n", n, N);
+	fprintf(fd, "===================\n");
+	fprintf(fd, "\nLinks used by a route of the namelist: %zu of %d\n", top.size(), num_edges);
+	fprintf(fd, "Highest expected congestion of a link: %f (a lower bound of the expected maximal congestion)\n", max_mean);
+	fprintf(fd, "The maximal congestion is below %d with a probability of at least %f\n", bound, 1 - prob);
+
+	for (int tier = 0; tier < LINK_TIERS; tier++)
+		fprintf(fd, "\n%s: %d links, %d used, expected congestion %f in total, %f at most, standard deviation %f at most",
+		        tier_names[tier], links[tier], used[tier], tier_sum[tier], tier_max[tier], tier_sigma[tier]);
+	fprintf(fd, "\n");
+
+	/* the links by expected load (highest first), then by edge id */
+	if (!cmdargs->args_info.full_cable_cong_given) {
+		size_t count = std::min(top.size(), (size_t) std::max(0, cmdargs->args_info.top_links_arg));
+		mean_before order = {&mean};
+
+		std::partial_sort(top.begin(), top.begin() + count, top.end(), order);
+		top.resize(count);
+		fprintf(fd, "\nThe %zu links with the highest expected congestion:\n", count);
+	} else {
+		fprintf(fd, "\nAll links used by a route of the namelist:\n");
+	}
+	fprintf(fd, "\n Edge-ID\texp. cong\tvariance\tlink\n");
+	for (std::vector<edgeid_t>::iterator iter = top.begin(); iter != top.end(); ++iter)
+		fprintf(fd, "%i\t%f\t%f\t%s -> %s\n", *iter, mean[*iter], var[*iter],
+		        get_node_name(get_edge_tail(*iter)), get_node_name(mytopology.edge_head[*iter]));
+}
@@ -0,0 +1,31 @@
+#ifndef ANALYTIC_HPP
+#define ANALYTIC_HPP
+
+#include <vector>
+#include <stdio.h>
+#include "simulator.hpp"
+
+/* The route statistics of one link over all ordered host pairs (a,b) of
+ * the namelist whose route uses it: the number of pairs, the sums over the
+ * hosts of the squared number of pairs that start (end) there, the sum
+ * over the hosts of the product of both, and the number of pairs whose
+ * reverse pair uses the link as well. These are all that the first two
+ * moments of the load under a random permutation depend on. */
+typedef struct {
+	std::vector<double> pairs;
+	std::vector<double> out_sq;
+	std::vector<double> in_sq;
+	std::vector<double> in_out;
+	std::vector<double> reverse;
+} link_pair_stats_t;
+
+/* prototypes */
+void get_link_pair_stats(IN namelist_t *namelist, IN int first, IN int count, OUT link_pair_stats_t *stats);
+/* The same from the route trees for all hosts, the switches with hosts
+ * are split among the processes. Returns false (and leaves stats alone)
+ * if there are no route trees, a host is not attached to a switch by a
+ * single uplink or a switch with hosts does not reach every host. */
+bool get_tree_link_pair_stats(IN namelist_t *namelist, IN int mynode, IN int allnodes, OUT link_pair_stats_t *stats);
+void analytic_rand_loads(IN cmdargs_t *cmdargs, IN namelist_t *namelist, FILE *fd, int mynode, int allnodes);
+
+#endif
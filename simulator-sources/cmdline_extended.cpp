@@ -643,6 +643,13 @@ void perform_sanity_checks_in_args(IN OUT cmdargs_t *cmdargs,
 		}
 	}
 
+	if (cmdargs->args_info.route_cache_arg < 0) {
+		if (my_mpi_rank == 0)
+			fprintf(stderr, "ERROR: The 'route_cache' budget can not be negative.\n");
+		MPI_Finalize();
+		exit(EXIT_FAILURE);
+	}
+
 	/* Check the pattern name, and if the chosen pattern needs a
 	 * mandatory pattern argument that hasn't been provided, warn
 	 * and exit. */
@@ -14,9 +14,15 @@
 #include <string.h>
 #include <cgraph.h>
 #include <mpi.h>
+#include <pthread.h>
+#include <deque>
 #include "pattern_generator.hpp"
 #include "simulator.hpp"
 #include "statistics.hpp"
+#include "topology.hpp"
+#include "routing.hpp"
+#include "placement.hpp"
+#include "analytic.hpp"
 #include "cmdline.h"
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,13 +34,375 @@ extern void perform_sanity_checks_in_args(IN OUT cmdargs_t *cmdargs,
                                           IN int my_mpi_rank);
 extern void cleanup_args(IN char *ptrn, void *ptrnarg);
 
+/* With several threads, the levels of the runs are evaluated as tasks. A
+ * run group holds the runs of one chunk of the run queue, they are
+ * evaluated together as the lanes of a batch. Every level of a group is a
+ * task, the lanes of the levels are added up in the group, and the worker
+ * that evaluates the last level of a group accounts its runs. */
+typedef struct {
+	int first_run;
+	std::vector<namelist_t> namelists;  /* lane -> namelist */
+	int pending;                        /* levels that have not been evaluated yet */
+	std::vector<bucket_t> run_bucket;   /* lane -> weights of the run so far (hist_acc_band) */
+	std::vector<int> run_sum;           /* lane -> sum of the maximum congestions so far (sum_max_cong) */
+	pthread_mutex_t lock;
+} run_group_t;
+
+typedef struct {
+	run_group_t *group;
+	int level;
+} level_task_t;
+
+/* Every worker puts the tasks of the groups it takes on its own deque and
+ * works from the back. Idle workers steal from the front of the other
+ * deques, so many small levels (ring) or a few huge ones (tree) keep all
+ * threads busy. */
+typedef struct {
+	std::deque<level_task_t> tasks;
+	pthread_mutex_t lock;
+} task_deque_t;
+
+/* The groups that have been taken and are not accounted yet. A worker
+ * that finds no task waits while there are open groups, until new tasks
+ * come up or the last group is accounted; version counts these events. */
+typedef struct {
+	int open;
+	unsigned int version;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} open_groups_t;
+
+/* A worker takes chunks of runs from the run queue until all runs are
+ * taken and simulates them with its own accumulator. The topology, the
+ * forwarding tables and the route store are shared and only read while
+ * the workers run. */
+typedef struct {
+	cmdargs_t *cmdargs;
+	namelist_t *namelist;
+	namelist_t *part_namelist;
+	namelist_t *nodeorder_namelist;
+	int mynode, allnodes;
+	int max_lanes;
+	run_queue_t *queue;
+	stats_acc_t *acc;
+	pthread_t thread;
+	int index;                          /* of the worker */
+	std::vector<task_deque_t> *deques;  /* worker -> deque, NULL if the runs are not split into tasks */
+	open_groups_t *open_groups;
+	int first_level, num_levels;        /* the levels of every run */
+} worker_t;
+
+/* Draws the namelist of a run. With --seed, the shuffles of run i only
+ * depend on the seed and i, so a run gets the same namelist on whichever
+ * process or thread it is simulated (the random patterns are not seeded). */
+static void get_final_namelist(IN worker_t *worker, IN int run, OUT namelist_t *final_namelist) {
+	cmdargs_t *cmdargs = worker->cmdargs;
+	MTRand::uint32 key[2] = {(MTRand::uint32) cmdargs->args_info.seed_arg, (MTRand::uint32) run};
+	MTRand mtrand(key, 2);
+	MTRand *run_mtrand = cmdargs->args_info.seed_given ? &mtrand : NULL;
+	namelist_t part_namelist;
+	size_t i;
+
+	/* Shuffle the list. The final_namelist will be used to run the
+	 * simulations. However, */
+	*final_namelist = *worker->namelist;
+	if (!cmdargs->args_info.do_not_shuffle_given)
+		shuffle_namelist(final_namelist, run_mtrand);
+
+	/* If we use a subset for the first-part communicator (only when ptrnvsptrn is used)
+	 * add the part_namelist on top of the existing final_namelist. */
+	if (strcmp(cmdargs->args_info.part_subset_arg, "none") != 0) {
+		part_namelist = *worker->part_namelist;
+		if (!cmdargs->args_info.do_not_shuffle_given)
+			shuffle_namelist(&part_namelist, run_mtrand);
+
+		for (i = 0; i < part_namelist.size(); i++)
+			final_namelist->insert(final_namelist->begin() + i, part_namelist.at(i));
+	}
+
+	/* If the user has provided a nodeorder guid list we need to push these nodes
+	 * to the front of the final_namelist */
+	for (i = 0; i < worker->nodeorder_namelist->size(); i++)
+		final_namelist->insert(final_namelist->begin() + i, worker->nodeorder_namelist->at(i));
+
+	/* The function print_namelist_from_all used MPI_Send and MPI_Recv
+	 * to print the namelist from all the MPI nodes to node 0. */
+	if (cmdargs->args_info.printnamelist_given)
+		print_namelist_from_all(final_namelist, worker->mynode, worker->allnodes);
+}
+
+/* Simulates the runs first_run .. first_run+num_runs-1 */
+static void simulate_runs(IN OUT worker_t *worker, int first_run, int num_runs) {
+	cmdargs_t *cmdargs = worker->cmdargs;
+	stats_acc_t *acc = worker->acc;
+	int mynode = worker->mynode;
+	std::vector<namelist_t> final_namelists;
+	std::vector<ptrn_t> ptrns;
+	std::vector<bool> finished;
+	int run_count, lanes, lane;
+
+	for (run_count = 1; run_count <= num_runs; run_count += lanes) { // perform simulations
+		int run = first_run + run_count - 1;
+
+		int level = cmdargs->args_info.ptrn_level_arg;
+		if(level < 0) level = 0;
+
+		lanes = std::min(worker->max_lanes, num_runs - run_count + 1);
+		final_namelists.resize(lanes);
+		stats_acc_begin_runs(acc, run, lanes);
+		for (lane = 0; lane < lanes; lane++)
+			get_final_namelist(worker, run + lane, &final_namelists[lane]);
+
+		if(strcmp(cmdargs->args_info.metric_arg, "dep_max_delay") == 0) {
+			simulation_dep_max_delay(cmdargs, &final_namelists[0], cmdargs->args_info.part_commsize_arg, mynode, acc);
+			if (cmdargs->args_info.verbose_given && (mynode == 0)) {
+				std::cout << "Process " << mynode << ": Simulation run number ";
+				std::cout << run + 1 << " finished.\n" << std::flush;
+			}
+		} else {
+			// TODO: uebelst beschissen but a fast solution to the problem.
+			finished.assign(lanes, false);
+			while (1) {
+				int running = 0;
+
+				/* a run ends with its first empty level */
+				ptrns.assign(lanes, ptrn_t());
+				for (lane = 0; lane < lanes; lane++) {
+					if (finished[lane])
+						continue;
+					genptrn_by_name(&ptrns[lane], cmdargs->args_info.ptrn_arg, cmdargs->ptrnarg,
+					                cmdargs->args_info.commsize_arg, cmdargs->args_info.part_commsize_arg,
+					                level, mynode);
+					if (ptrns[lane].size() == 0)
+						finished[lane] = true;
+					else
+						running++;
+				}
+
+				if (running == 0 || (cmdargs->args_info.ptrn_level_arg > -1 && level > cmdargs->args_info.ptrn_level_arg)) {break;}
+				if ((cmdargs->args_info.printptrn_given) && (mynode == 0)) { printptrn(&ptrns[0], &final_namelists[0]); }
+
+				acc->level = level;
+				if (lanes == 1)
+					simulation_with_metric(cmdargs->args_info.metric_arg, &ptrns[0], &final_namelists[0], RUN, acc);
+				else
+					simulation_multirun_with_metric(cmdargs->args_info.metric_arg, &ptrns, &final_namelists, RUN, acc);
+
+				if (cmdargs->args_info.verbose_given && (mynode == 0)) {
+					for (lane = 0; lane < lanes; lane++) {
+						if (ptrns[lane].size() == 0)
+							continue;
+						std::cout << "Process " << mynode << ": Simulation run number ";
+						std::cout << run + lane + 1 << ", level " << level << " finished.\n" << std::flush;
+					}
+				}
+
+				level++; //proceed to next level
+			}
+			if (lanes == 1)
+				simulation_with_metric(cmdargs->args_info.metric_arg, NULL, &final_namelists[0], ACCOUNT, acc);
+			else
+				simulation_multirun_with_metric(cmdargs->args_info.metric_arg, NULL, &final_namelists, ACCOUNT, acc);
+		}
+		//TODO Add support for error treshold(?)
+	}
+}
+
+/* Accounts the runs of a group whose levels have all been evaluated */
+static void account_group(IN OUT worker_t *worker, IN run_group_t *group) {
+	char *metric = worker->cmdargs->args_info.metric_arg;
+	stats_acc_t *acc = worker->acc;
+
+	stats_acc_begin_runs(acc, group->first_run, group->namelists.size());
+	acc->run_bucket = group->run_bucket;
+	acc->run_sum = group->run_sum;
+	if (group->namelists.size() == 1)
+		simulation_with_metric(metric, NULL, &group->namelists[0], ACCOUNT, acc);
+	else
+		simulation_multirun_with_metric(metric, NULL, &group->namelists, ACCOUNT, acc);
+}
+
+/* Adds delta to the open groups, a delta of 0 announces new tasks */
+static void change_open_groups(IN OUT open_groups_t *groups, int delta) {
+	pthread_mutex_lock(&groups->lock);
+	groups->open += delta;
+	if ((delta == 0) || (groups->open == 0)) {
+		groups->version++;
+		pthread_cond_broadcast(&groups->changed);
+	}
+	pthread_mutex_unlock(&groups->lock);
+}
+
+/* Takes the next chunk of runs from the run queue and puts the tasks of
+ * its levels on the deque of the worker, returns false if all runs are
+ * taken */
+static bool take_run_group(IN OUT worker_t *worker) {
+	task_deque_t *deque = &(*worker->deques)[worker->index];
+	int first_run, num_runs, lane, level;
+
+	/* the group is counted before it is taken, so that no other worker
+	 * finds the queue empty and no open group before its tasks are on
+	 * the deque */
+	change_open_groups(worker->open_groups, 1);
+	if (!run_queue_next(worker->queue, &first_run, &num_runs)) {
+		change_open_groups(worker->open_groups, -1);
+		return false;
+	}
+
+	run_group_t *group = new run_group_t;
+	group->first_run = first_run;
+	group->namelists.resize(num_runs);
+	for (lane = 0; lane < num_runs; lane++)
+		get_final_namelist(worker, first_run + lane, &group->namelists[lane]);
+	group->pending = worker->num_levels;
+	group->run_bucket.assign(num_runs, bucket_t());
+	group->run_sum.assign(num_runs, 0);
+	pthread_mutex_init(&group->lock, NULL);
+
+	if (worker->num_levels == 0) {
+		account_group(worker, group);
+		pthread_mutex_destroy(&group->lock);
+		delete group;
+		change_open_groups(worker->open_groups, -1);
+		return true;
+	}
+
+	pthread_mutex_lock(&deque->lock);
+	for (level = worker->first_level; level < worker->first_level + worker->num_levels; level++) {
+		level_task_t task = {group, level};
+		deque->tasks.push_back(task);
+	}
+	pthread_mutex_unlock(&deque->lock);
+	change_open_groups(worker->open_groups, 0);
+	return true;
+}
+
+/* Takes a task from the back of the own deque or from the front of
+ * another one */
+static bool get_level_task(IN worker_t *worker, OUT level_task_t *task) {
+	int count = worker->deques->size();
+
+	for (int i = 0; i < count; i++) {
+		task_deque_t *deque = &(*worker->deques)[(worker->index + i) % count];
+		bool found = false;
+
+		pthread_mutex_lock(&deque->lock);
+		if (!deque->tasks.empty()) {
+			if (i == 0) {
+				*task = deque->tasks.back();
+				deque->tasks.pop_back();
+			} else {
+				*task = deque->tasks.front();
+				deque->tasks.pop_front();
+			}
+			found = true;
+		}
+		pthread_mutex_unlock(&deque->lock);
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+/* Evaluates one level of all runs of a group. The lanes of the level are
+ * evaluated in the accumulator of the worker and then added to the group. */
+static void run_level_task(IN OUT worker_t *worker, IN level_task_t *task) {
+	cmdargs_t *cmdargs = worker->cmdargs;
+	stats_acc_t *acc = worker->acc;
+	run_group_t *group = task->group;
+	int lanes = group->namelists.size();
+	std::vector<ptrn_t> ptrns(lanes);
+	int lane;
+	bool last;
+
+	for (lane = 0; lane < lanes; lane++)
+		genptrn_by_name(&ptrns[lane], cmdargs->args_info.ptrn_arg, cmdargs->ptrnarg,
+		                cmdargs->args_info.commsize_arg, cmdargs->args_info.part_commsize_arg,
+		                task->level, worker->mynode);
+
+	stats_acc_begin_runs(acc, group->first_run, lanes);
+	acc->level = task->level;
+	if (lanes == 1)
+		simulation_with_metric(cmdargs->args_info.metric_arg, &ptrns[0], &group->namelists[0], RUN, acc);
+	else
+		simulation_multirun_with_metric(cmdargs->args_info.metric_arg, &ptrns, &group->namelists, RUN, acc);
+
+	if (cmdargs->args_info.verbose_given && (worker->mynode == 0)) {
+		for (lane = 0; lane < lanes; lane++) {
+			std::cout << "Process " << worker->mynode << ": Simulation run number ";
+			std::cout << group->first_run + lane + 1 << ", level " << task->level << " finished.\n" << std::flush;
+		}
+	}
+
+	pthread_mutex_lock(&group->lock);
+	for (lane = 0; lane < lanes; lane++) {
+		bucket_t *from = &acc->run_bucket[lane], *to = &group->run_bucket[lane];
+
+		if (to->size() < from->size())
+			to->resize(from->size(), 0);
+		for (size_t i = 0; i < from->size(); i++)
+			(*to)[i] += (*from)[i];
+		group->run_sum[lane] += acc->run_sum[lane];
+	}
+	last = (--group->pending == 0);
+	pthread_mutex_unlock(&group->lock);
+
+	/* the continuation of the group */
+	if (last) {
+		account_group(worker, group);
+		pthread_mutex_destroy(&group->lock);
+		delete group;
+		change_open_groups(worker->open_groups, -1);
+	}
+}
+
+static void *run_worker(void *arg) {
+	worker_t *worker = (worker_t *) arg;
+	level_task_t task;
+	int first_run, num_runs;
+
+	if (worker->deques == NULL) {
+		while (run_queue_next(worker->queue, &first_run, &num_runs))
+			simulate_runs(worker, first_run, num_runs);
+		route_store_flush_stats();
+		return NULL;
+	}
+
+	/* A worker is done when all runs are taken and all groups are
+	 * accounted. Until then it keeps looking for tasks, the worker that
+	 * took the last groups may not have put their tasks on its deque yet. */
+	open_groups_t *groups = worker->open_groups;
+	while (true) {
+		pthread_mutex_lock(&groups->lock);
+		unsigned int version = groups->version;
+		pthread_mutex_unlock(&groups->lock);
+
+		if (get_level_task(worker, &task)) {
+			run_level_task(worker, &task);
+			continue;
+		}
+		if (take_run_group(worker))
+			continue;
+
+		pthread_mutex_lock(&groups->lock);
+		while ((groups->open > 0) && (groups->version == version))
+			pthread_cond_wait(&groups->changed, &groups->lock);
+		bool done = (groups->open == 0);
+		pthread_mutex_unlock(&groups->lock);
+		if (done)
+			break;
+	}
+	route_store_flush_stats();
+	return NULL;
+}
+
 int main(int argc, char **argv) {
 	
 	// MPI variables, comm_rank and comm_size
 	int mynode, allnodes;
-	namelist_t namelist, part_namelist, complete_namelist, nodeorder_namelist, final_namelist;
+	namelist_t namelist, part_namelist, complete_namelist, nodeorder_namelist;
 	guidlist_t guidlist, part_guidlist, complete_guidlist, nodeorder_guidlist;
-	int i, j;
+	int i;
 
 	cmdargs_t cmdargs;
 
@@ -65,7 +433,17 @@ int main(int argc, char **argv) {
 	}
 
 	read_input_graph(cmdargs.args_info.input_file_arg, mynode);
-	tag_edges(mygraph);
+
+	/* Everything we need from the graph goes into the topology snapshot,
+	 * so the cgraph object can be freed right away */
+	build_topology(mygraph);
+	compile_forwarding_tables();
+	agclose(mygraph);
+	mygraph = NULL;
+
+	init_route_store((size_t) cmdargs.args_info.route_cache_arg * 1024 * 1024);
+	/* every worker and every thread of a split level has its own cache */
+	route_cache_set_threads(std::max(1, cmdargs.args_info.threads_arg) * std::max(1, cmdargs.args_info.level_threads_arg));
 
 	/* Read the node ordering if provided */
 	if (mynode == 0)
@@ -120,26 +498,41 @@ int main(int argc, char **argv) {
 
 		if (cmdargs.args_info.checkinputfile_given) {
 			printf("   Number of hosts in the inputfile: %zu\n", complete_namelist.size());
-			printf("Number of switches in the inputfile: %d\n", agnnodes(mygraph) - complete_namelist.size());
-			printf("   Number of edges in the inputfile: %d\n", agnedges(mygraph));
-
-			for (i = 0; i < complete_namelist.size(); i++) {
-				for (j = 0; j < complete_namelist.size(); j++) {
-					printf("Testing pair number %zu of %zu\n",
-					       i * complete_namelist.size() + j + 1,
-					       complete_namelist.size() * complete_namelist.size());
-					uroute_t r;
-					find_route(&r, complete_namelist.at(i), complete_namelist.at(j));
-				}
-			}
-			printf("Completed\n");
-			return EXIT_SUCCESS;
+			printf("Number of switches in the inputfile: %d\n", get_num_switches());
+			printf("   Number of edges in the inputfile: %d\n", get_num_edges());
 		}
 
 		/* we have to use all hosts for the route quality assessment */
 		if (cmdargs.args_info.routequal_given) cmdargs.args_info.commsize_arg = complete_namelist.size();
 	}
 
+	/* Check all routes of the input file, the destinations are split among
+	 * the ranks and their threads. The broken pairs go to the output file. */
+	if (cmdargs.args_info.checkinputfile_given) {
+		route_check_t check;
+		FILE *fd = stdout;
+
+		int myn = get_num_hosts()/allnodes;
+		int mystart = myn*mynode;
+		if(mynode == allnodes-1) myn = get_num_hosts()-mystart;
+
+		check_routes(mystart, myn, std::max(1, cmdargs.args_info.threads_arg), &check);
+
+		if ((mynode == 0) && (strcmp(cmdargs.args_info.output_file_arg, "-") != 0)) {
+			fd = fopen(cmdargs.args_info.output_file_arg, "w");
+			if (fd == NULL) {
+				printf("Could not open output file '%s'\n", cmdargs.args_info.output_file_arg);
+				MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+			}
+		}
+		print_route_check(&check, stdout, fd, mynode, allnodes);
+		if (fd != stdout) fclose(fd);
+
+		if (mynode == 0) printf("Completed\n");
+		MPI_Finalize();
+		return EXIT_SUCCESS;
+	}
+
 	/* Get a list of all endpoint-names that we will work with from the dot-file
 	 * This list, the namelist, may be a subset of the complete list. */
 	if (mynode == 0)
@@ -173,71 +566,45 @@ int main(int argc, char **argv) {
 	if(mynode == 0) {
 		printf("      Number of hosts in the subset: %zu\n", namelist.size());
 		printf("   Number of hosts in the inputfile: %zu\n", complete_namelist.size());
-		printf("Number of switches in the inputfile: %d\n", agnnodes(mygraph) - complete_namelist.size());
-		printf("   Number of edges in the inputfile: %d\n", agnedges(mygraph));
+		printf("Number of switches in the inputfile: %d\n", get_num_switches());
+		printf("   Number of edges in the inputfile: %d\n", get_num_edges());
 	}
 
 	/* Assess the quality of the routing table */
 	if (cmdargs.args_info.routequal_given) {
-		cable_cong_map_t cable_cong;
-		int nconn = namelist.size()*namelist.size();
-		
+		std::vector<int> cable_cong;
+		std::map<int, int> bins;
+
+		/* The routes are evaluated per destination (see all_to_all_link_loads),
+		 * so the destinations are split among the ranks */
 		int myn = namelist.size()/allnodes;
 		int mystart = myn*mynode;
 		if(mynode == allnodes-1) myn = namelist.size()-mystart;
 
 		/* generate cable-congestion by all routes */
-		for (i = mystart; i < mystart+myn; i++) {
-			for (j = 0; j < namelist.size(); j++) {
-				uroute_t route;
-				find_route(&route, namelist.at(i), namelist.at(j));
-				insert_route_into_cable_cong_map(&cable_cong, &route);
-			}
-		}
+		all_to_all_link_loads(&namelist, mystart, myn, &cable_cong);
 		/* allreduce cable_cong if parallel */
-		if(allnodes > 1) allreduce_contig_int_map(&cable_cong);
+		if(allnodes > 1 && !cable_cong.empty()) {
+			std::vector<int> sum(cable_cong.size());
+			MPI_Allreduce(&cable_cong[0], &sum[0], cable_cong.size(), MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+			cable_cong.swap(sum);
+		}
 
 		/* begin analysis */
-		int iter = 0;
-		const unsigned int maxiters = (unsigned int)(~0x0)-1; //100000;
-		MTRand mtrand;
-		std::map<int, int> bins;
-		unsigned int gmax=0, gmin=(unsigned int)(~0x0)-1;
-		for (i = mystart; i < mystart+myn; i++) {
-			for (j = 0; j < namelist.size(); j++) {
-				if(iter++ < maxiters/allnodes) {
-					int src, tgt;
-					if(nconn < maxiters) {
-						//if((mynode == 0) && ((iter) % 1000 == 0)) printf("Evaluating pair number %d of %d (%.2f%%)\n", iter, nconn/allnodes, (float)iter/nconn*allnodes*100);
-						src=i; tgt=j;
-					} else {
-						if((mynode == 0) && ((iter) % 1000 == 0)) printf("Evaluating pair number %d of %d (%.2f%%)\n", iter, maxiters/allnodes, (float)iter/maxiters*allnodes*100);
-						src = mtrand.randInt(namelist.size()-1);
-						tgt = mtrand.randInt(namelist.size()-1);
-					}
-					uroute_t route;
-					find_route(&route, namelist.at(src), namelist.at(tgt));
-
-					int max = 0;
-					for(uroute_t::iterator iter=route.begin(); iter!=route.end(); ++iter) {
-						//printf("%i\n", cable_cong[*iter]);
-						/* do not evaluate the first and last edge! */
-						if(iter != route.begin() && (iter+1) != route.end()) {
-							if(cable_cong[*iter] > max) max = cable_cong[*iter];
-						}
-						//printf("%i ", cable_cong[*iter]);
-					}
-					//printf("| %i -> %i: %i\n", src, tgt, max);
-					if(max > gmax) gmax = max;
-					if((max < gmin) && (max > 0)) gmin = max;
-					if(!bins.count(max)) bins[max] = 0;
-					bins[max]++;
-				}
-			}
-		}
+		all_to_all_max_loads(&namelist, mystart, myn, &cable_cong, &bins);
 		/* allreduce bins if parallel */
 		if(allnodes > 1) allreduce_contig_int_map(&bins);
 
+		unsigned int gmax=0, gmin=(unsigned int)(~0x0)-1;
+		for(std::map<int, int>::iterator i=bins.begin(); i!=bins.end(); ++i) {
+			if(i->second == 0) continue;
+			if(i->first > gmax) gmax = i->first;
+			if((i->first < gmin) && (i->first > 0)) gmin = i->first;
+		}
+
+		if (cmdargs.args_info.verbose_given)
+			print_route_cache_stats(stdout, mynode, allnodes);
+
 		if(mynode == 0) {
 			printf("gmin: %u, gmax: %u\n", gmin, gmax);
 
@@ -271,6 +638,35 @@ int main(int argc, char **argv) {
 		return EXIT_SUCCESS;
 	}
 
+	/* The expected link loads of the rand pattern follow from the routes of
+	 * all host pairs of the namelist, no runs are needed */
+	if (cmdargs.args_info.analytic_given) {
+		FILE *fd = stdout;
+
+		if ((strcmp(cmdargs.args_info.ptrn_arg, "rand") != 0) || nodeorder_guidlist.size() ||
+		    (strcmp(cmdargs.args_info.part_subset_arg, "none") != 0) || cmdargs.args_info.do_not_shuffle_given) {
+			if (mynode == 0)
+				fprintf(stderr, "ERROR: 'analytic' needs the 'rand' pattern without a node ordering file, 'part_subset' and 'do_not_shuffle'.\n");
+			MPI_Finalize();
+			exit(EXIT_FAILURE);
+		}
+
+		if ((mynode == 0) && (strcmp(cmdargs.args_info.output_file_arg, "-") != 0)) {
+			fd = fopen(cmdargs.args_info.output_file_arg, "w");
+			if (fd == NULL) {
+				printf("Could not open output file '%s'\n", cmdargs.args_info.output_file_arg);
+				MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+			}
+			print_commandline_options(fd, &cmdargs);
+		}
+		analytic_rand_loads(&cmdargs, &namelist, fd, mynode, allnodes);
+		if (fd != stdout) fclose(fd);
+
+		cleanup_args(cmdargs.args_info.ptrn_arg, cmdargs.ptrnarg);
+		MPI_Finalize();
+		return EXIT_SUCCESS;
+	}
+
 	/* If the user has provided a nodeorder guid list we may need to modify the namelist,
 	 * or the part_namelist if the part_subset_arg is not "none". */
 	if (nodeorder_guidlist.size()) {
@@ -321,7 +717,7 @@ int main(int argc, char **argv) {
 		 * nodenames that exist in the nodeorder_namelist. We will re-add the removed entries
 		 * in the "final_namelist", but after the shuffling of the "namelist" has occured
 		 * (that's how we ensure the node-ordering). */
-		std::vector<std::string>::iterator str_iter;
+		namelist_t::iterator str_iter;
 		for (i = 0; i < nodeorder_namelist.size(); i++) {
 			str_iter = std::find(tmp_namelist->begin(), tmp_namelist->end(), nodeorder_namelist.at(i));
 			if (str_iter != tmp_namelist->end())
@@ -334,7 +730,7 @@ int main(int argc, char **argv) {
 		/* If the part_subset is not "none", we need to remove the part_namelist
 		 * entries from the namelist in order to ensure we will have unique
 		 * entries in the final_namelist..... */
-		std::vector<std::string>::iterator str_iter;
+		namelist_t::iterator str_iter;
 		for (i = 0; i < part_namelist.size(); i++) {
 			str_iter = std::find(namelist.begin(), namelist.end(), part_namelist.at(i));
 			if (str_iter != namelist.end())
@@ -363,84 +759,167 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	int run_count = 1;
-
-	while (1) { // perform simulations
-
-		int level = cmdargs.args_info.ptrn_level_arg;
-		if(level < 0) level = 0;
-
-		/* Shuffle the list */
-		if (!cmdargs.args_info.do_not_shuffle_given)
-			shuffle_namelist(&namelist);
-
-		/* Copy the shuffled list to the final_namelist. The final_namelist
-		 * will be used to run the simulations. However, */
-		final_namelist = namelist;
-
-		/* If we use a subset for the first-part communicator (only when ptrnvsptrn is used)
-		 * add the part_namelist on top of the existing final_namelist. */
-		if (strcmp(cmdargs.args_info.part_subset_arg, "none") != 0) {
-			if (!cmdargs.args_info.do_not_shuffle_given)
-				shuffle_namelist(&part_namelist);
+	/* the simulation loop used to test the run count after a run, so
+	 * there is at least one run even for --num_runs 0 */
+	int num_runs = std::max(1, cmdargs.args_info.num_runs_arg);
+	int num_threads = std::max(1, cmdargs.args_info.threads_arg);
+	level_threads = std::max(1, cmdargs.args_info.level_threads_arg);
+
+	/* The metrics that only look at the congestion within the levels
+	 * evaluate up to MULTIRUN_LANES runs at once. The namelists of the runs
+	 * are drawn one after the other as before, so this gives the same
+	 * results as running them in sequence. Printing the patterns or the
+	 * namelists keeps the runs apart. */
+	int max_lanes = 1;
+	if (((strcmp(cmdargs.args_info.metric_arg, "hist_max_cong") == 0) ||
+	     (strcmp(cmdargs.args_info.metric_arg, "sum_max_cong") == 0) ||
+	     (strcmp(cmdargs.args_info.metric_arg, "hist_acc_band") == 0)) &&
+	    !cmdargs.args_info.printptrn_given && !cmdargs.args_info.printnamelist_given &&
+	    !cmdargs.args_info.optimize_placement_given && (cmdargs.args_info.hot_links_arg <= 0))
+		max_lanes = MULTIRUN_LANES;
+
+	/* Printing the namelists talks to the other processes, get_cable_cong
+	 * adds to one global map and ptrnvsptrn keeps the level of its second
+	 * pattern between the calls, so these run in a single thread */
+	if ((num_threads > 1) &&
+	    (cmdargs.args_info.printptrn_given || cmdargs.args_info.printnamelist_given ||
+	     cmdargs.args_info.optimize_placement_given ||
+	     (strcmp(cmdargs.args_info.metric_arg, "get_cable_cong") == 0) ||
+	     (strcmp(cmdargs.args_info.ptrn_arg, "ptrnvsptrn") == 0))) {
+		if (mynode == 0)
+			printf("Warning: these options do not support threads, the runs are simulated in one thread.\n");
+		num_threads = 1;
+	}
+	/* the workers only call MPI for the run queue, which a single process
+	 * keeps locally (see run_queue_init) */
+	if ((num_threads > 1) && (allnodes > 1) && (mpi_thread_support < MPI_THREAD_SERIALIZED)) {
+		if (mynode == 0)
+			printf("Warning: the MPI library does not support threads, the runs are simulated in one thread.\n");
+		num_threads = 1;
+	}
+	num_threads = std::min(num_threads, num_runs);
+
+	/* The runs are handed out in chunks as the workers of all processes
+	 * ask for them, a chunk fills a batch of lanes. Printing the namelists
+	 * needs all processes to draw their namelists in lock step, so every
+	 * process gets the same number of runs there. */
+	run_queue_t queue;
+	run_queue_init(&queue, num_runs, max_lanes, !cmdargs.args_info.printnamelist_given, mynode, allnodes);
+
+	/* With several threads, the levels of the runs are split into tasks
+	 * (see run_group_t). The runs all have the levels of the pattern, they
+	 * are counted once up front. dep_max_delay looks at all levels of a run
+	 * at once, its runs stay whole. */
+	std::vector<task_deque_t> deques;
+	open_groups_t open_groups;
+	int first_level = std::max(0, cmdargs.args_info.ptrn_level_arg), num_levels = 0;
+	bool level_tasks = (num_threads > 1) && (strcmp(cmdargs.args_info.metric_arg, "dep_max_delay") != 0);
+
+	if (level_tasks) {
+		while (1) {
+			ptrn_t ptrn;
 
-			for (i = 0; i < part_namelist.size(); i++)
-				final_namelist.insert(final_namelist.begin() + i, part_namelist.at(i));
-		}
+			genptrn_by_name(&ptrn, cmdargs.args_info.ptrn_arg, cmdargs.ptrnarg,
+			                cmdargs.args_info.commsize_arg, cmdargs.args_info.part_commsize_arg,
+			                first_level + num_levels, mynode);
+			if (ptrn.size() == 0) { break; }
 
-		/* If the user has provided a nodeorder guid list we need to push these nodes
-		 * to the front of the final_namelist */
-		if (nodeorder_guidlist.size()) {
-			/* Now push the ordered names in the front of the final_namelist that
-			 * already contains the contents of the shuffled namelist. */
-			for (i = 0; i < nodeorder_namelist.size(); i++)
-				final_namelist.insert(final_namelist.begin() + i, nodeorder_namelist.at(i));
+			num_levels++;
+			if (cmdargs.args_info.ptrn_level_arg > -1) { break; }
 		}
+		deques.resize(num_threads);
+		for (i = 0; i < num_threads; i++)
+			pthread_mutex_init(&deques[i].lock, NULL);
+		open_groups.open = 0;
+		open_groups.version = 0;
+		pthread_mutex_init(&open_groups.lock, NULL);
+		pthread_cond_init(&open_groups.changed, NULL);
+	}
 
-		/* The function print_namelist_from_all used MPI_Send and MPI_Recv
-		 * to print the namelist from all the MPI nodes to node 0. */
-		if (cmdargs.args_info.printnamelist_given)
-			print_namelist_from_all(&final_namelist, mynode, allnodes);
+	std::vector<worker_t> workers(num_threads);
+	std::vector<stats_acc_t> accs(num_threads);
+
+	set_top_links(cmdargs.args_info.top_links_arg);
+	for (i = 0; i < num_threads; i++) {
+		worker_t *worker = &workers[i];
+
+		worker->cmdargs = &cmdargs;
+		worker->namelist = &namelist;
+		worker->part_namelist = &part_namelist;
+		worker->nodeorder_namelist = &nodeorder_namelist;
+		worker->mynode = mynode;
+		worker->allnodes = allnodes;
+		worker->max_lanes = max_lanes;
+		worker->queue = &queue;
+		worker->index = i;
+		worker->deques = level_tasks ? &deques : NULL;
+		worker->open_groups = &open_groups;
+		worker->first_level = first_level;
+		worker->num_levels = num_levels;
+		worker->acc = &accs[i];
+		worker->acc->hot_links = std::max(0, cmdargs.args_info.hot_links_arg);
+	}
 
-		if(strcmp(cmdargs.args_info.metric_arg, "dep_max_delay") == 0) {
-			simulation_dep_max_delay(&cmdargs, &final_namelist, cmdargs.args_info.part_commsize_arg, mynode);
-			if (cmdargs.args_info.verbose_given && (mynode == 0)) {
-				std::cout << "Process " << mynode << ": Simulation run number ";
-				std::cout << run_count << " finished.\n" << std::flush;
+	/* Search for a better placement, starting from the namelist of the
+	 * first run. The ranks from the node ordering file stay where they
+	 * are, the others are only swapped within their communicator. */
+	if (cmdargs.args_info.optimize_placement_given) {
+		std::vector<int_pair_t> ranges;
+		namelist_t final_namelist;
+		FILE *fd = stdout;
+
+		get_final_namelist(&workers[0], 0, &final_namelist);
+		ranges.push_back(std::make_pair((int) nodeorder_namelist.size(), (int) part_namelist.size()));
+		ranges.push_back(std::make_pair((int) (nodeorder_namelist.size() + part_namelist.size()), (int) namelist.size()));
+
+		if ((mynode == 0) && (strcmp(cmdargs.args_info.output_file_arg, "-") != 0)) {
+			fd = fopen(cmdargs.args_info.output_file_arg, "w");
+			if (fd == NULL) {
+				printf("Could not open output file '%s'\n", cmdargs.args_info.output_file_arg);
+				MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
 			}
-		} else {
-			// TODO: uebelst beschissen but a fast solution to the problem.
-			while (1) {
-				ptrn_t ptrn;
-
-				genptrn_by_name(&ptrn, cmdargs.args_info.ptrn_arg, cmdargs.ptrnarg,
-				                cmdargs.args_info.commsize_arg, cmdargs.args_info.part_commsize_arg,
-				                level, mynode);
-
-				if (ptrn.size()==0 || (cmdargs.args_info.ptrn_level_arg > -1 && level > cmdargs.args_info.ptrn_level_arg)) {break;}
-				if ((cmdargs.args_info.printptrn_given) && (mynode == 0)) { printptrn(&ptrn, &final_namelist); }
-
-				simulation_with_metric(cmdargs.args_info.metric_arg, &ptrn, &final_namelist, RUN);
+		}
+		optimize_placement(&cmdargs, &final_namelist, &ranges, fd, mynode, allnodes);
+		if (fd != stdout) fclose(fd);
+		run_queue_free(&queue);
 
-				if (cmdargs.args_info.verbose_given && (mynode == 0)) {
-					std::cout << "Process " << mynode << ": Simulation run number ";
-					std::cout << run_count << ", level " << level << " finished.\n" << std::flush;
-				}
+		cleanup_args(cmdargs.args_info.ptrn_arg, cmdargs.ptrnarg);
+		MPI_Finalize();
+		return EXIT_SUCCESS;
+	}
 
-				level++; //proceed to next level
-			}
-			simulation_with_metric(cmdargs.args_info.metric_arg, NULL, &final_namelist, ACCOUNT);
+	/* The workers share the topology and the route store, the first one
+	 * runs in this thread, so that a single worker never leaves it */
+	for (i = 1; i < num_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+			printf("Could not start worker thread %d\n", i);
+			MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
 		}
-		run_count++;
-		//TODO Add support for error treshold(?)
-		if (run_count > ceil((double) cmdargs.args_info.num_runs_arg / (double) allnodes)) {break;}
 	}
+	run_worker(&workers[0]);
+	for (i = 1; i < num_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	/* process 0 collects the namelists of every round of the static
+	 * queue, the processes with fewer runs tell it they have none */
+	if (cmdargs.args_info.printnamelist_given)
+		for (i = queue.num_runs; i < queue.rounds; i++)
+			print_namelist_from_all(NULL, mynode, allnodes);
+	for (i = 0; i < (int) deques.size(); i++)
+		pthread_mutex_destroy(&deques[i].lock);
+	if (level_tasks) {
+		pthread_mutex_destroy(&open_groups.lock);
+		pthread_cond_destroy(&open_groups.changed);
+	}
+	run_queue_free(&queue);
 
+	merge_stats(&accs[0], num_threads);
 	exchange_results_by_metric(cmdargs.args_info.metric_arg, mynode, allnodes);
+	if (cmdargs.args_info.hot_links_arg > 0)
+		exchange_hot_links(mynode, allnodes, cmdargs.args_info.hot_links_arg);
+	if (cmdargs.args_info.verbose_given)
+		print_route_cache_stats(stdout, mynode, allnodes);
 	print_results(&cmdargs, mynode, allnodes);
 
-	agclose(mygraph);
-
 	cleanup_args(cmdargs.args_info.ptrn_arg, cmdargs.ptrnarg);
 
 	MPI_Finalize();
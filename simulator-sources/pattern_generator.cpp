@@ -24,6 +24,7 @@
 #include <boost/assign/std/vector.hpp>
 #include "pattern_generator.hpp"
 #include "simulator.hpp"
+#include "topology.hpp"
 #include <mpi.h>
 
 template< class T >
@@ -44,78 +45,32 @@ struct next
 void genptrn_rand(int comm_size, int level,
                   ptrn_t *ptrn, int my_mpi_rank,
                   bool respect_print_once) {
-	/* this pattern generator draws two nodes, ensures that they are not the same
-	 * in order to avoid having nodes sending traffic to themselves (wight 0), and
-	 * puts them as communication pairs into the pattern */
+	/* this pattern generator sends every rank to another rank, each rank
+	 * receives once and no rank sends traffic to itself (weight 0) */
 	MTRand mtrand;
-	std::vector<int> available_dests_bucket;
-	int src = 0, dst = 0;
-	int myrand_pos;
-
-	if(level != 0) return;
-
-	/* Initialize the available_dests_bucket vector with values from 0 to comm_size - 1
-	 * Then we will use this vector to pull random destinations and form random
-	 * source -> destination pairs. Everytime we pull a value we remove it from the
-	 * bucket, thus, ensuring that we will not add any duplicate destinations */
-	boost::assign::push_back(available_dests_bucket).repeat_fun(comm_size, next<int>(0));
-
-	for (src = 0; src < comm_size; src++) {
-		while(true) {
-			myrand_pos = mtrand.randInt((comm_size - 1) - src);
-
-			dst = available_dests_bucket.at(myrand_pos);
-			/* We do not want to end up with pairs communicating with themeselves: e.g. 5 -> 5
-			 *
-			 * So add the pattern pair only if counter != pos.
-			 */
-			if (src != dst) {
-				ptrn->push_back(int_pair_t(src, dst));
-				available_dests_bucket.erase(available_dests_bucket.begin() + myrand_pos);
-				break;
-			} else {
-				/* If we run in this "else" statement, then src == dst.
-				 *
-				 * If this is not the last loop in the for statetement (src == (comm_size - 1)),
-				 * re-run in the while loop in order to re-draw a random number for the given src.
-				 */
-				if (src == (comm_size - 1)) {
-					/* However, there is a small chance that we may end up in a deadlock situation if we
-					 * reach the last pair and  all the previous random pairs are different. Then the only
-					 * possible last pair left is src == dst. Consider the following example:
-					 *
-					 * comm_size = 4:
-					 * Random pairs:
-					 * 0 -> 2
-					 * 1 -> 0
-					 * 2 -> 1
-					 * 3 -> 3 <------ Only choice left. We want to avoid this deadlock situation.
-					 *
-					 * In this case we want to swap a random number from the already added pairs...
-					 */
-					/* 1. Choose a new random tmp_pair from ptrn */
-					myrand_pos = mtrand.randInt(ptrn->size() - 1);
-					int_pair_t &tmp_pair = ptrn->at(myrand_pos);
-
-					/* 2. Store the destination value from the tmp_pair in variable dst. */
-					dst = tmp_pair.second;
-
-					/* 3. Change the destination value of the tmp_pair to the last available
-					 * value which is equal to (comm_size - 1). */
-					tmp_pair.second = (comm_size - 1);
-
-					/* 4. Use the stored dst value for the last pair. */
-					ptrn->push_back(int_pair_t(src, dst));
-
-					/* At this point there is only one element left in the vector, so
-					 * just delete the .begin() */
-					available_dests_bucket.erase(available_dests_bucket.begin());
-
-					break;
-				}
-			}
-		}
-	}
+	std::vector<int> dests(comm_size);
+	int src, i;
+	bool fixed;
+
+	if ((level != 0) || (comm_size < 2)) return;
+
+	/* A uniformly random permutation (Fisher-Yates), drawn again until no
+	 * rank is sent to itself. This gives every derangement the same
+	 * probability, which --analytic relies on; about e = 2.72 permutations
+	 * are drawn on average. */
+	do {
+		for (i = 0; i < comm_size; i++)
+			dests[i] = i;
+		for (i = comm_size - 1; i > 0; i--)
+			std::swap(dests[i], dests[mtrand.randInt(i)]);
+
+		fixed = false;
+		for (i = 0; i < comm_size; i++)
+			if (dests[i] == i) fixed = true;
+	} while (fixed);
+
+	for (src = 0; src < comm_size; src++)
+		ptrn->push_back(int_pair_t(src, dests[src]));
 }
 
 void genptrn_bisect(int comm_size, int level,
@@ -552,8 +507,8 @@ void printptrn(ptrn_t *ptrn, namelist_t *namelist) {
 	for(iter = ptrn->begin(); iter != ptrn->end(); ++iter) {
 		printf("% 5i -> %-5i   |   %s -> %s\n",
 		       iter->first, iter->second,
-		       namelist->at(iter->first).data(),
-		       namelist->at(iter->second).data());
+		       get_host_name(namelist->at(iter->first)),
+		       get_host_name(namelist->at(iter->second)));
 	}
 	printf("=================\n");
 }
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2009 The Trustees of Indiana University and Indiana
+ *                    University Research and Technology
+ *                    Corporation.  All rights reserved.
+ *
+ * Author(s): Timo Schneider <timoschn@cs.indiana.edu>
+ *            Torsten Hoefler <htor@cs.indiana.edu>
+ *
+ */
+
+/* Placement optimization searches for a mapping of the ranks of a pattern
+ * onto the hosts that keeps the congestion low, by simulated annealing
+ * over swaps of two ranks. A swap only changes the routes of the pairs the
+ * two ranks take part in, so instead of evaluating the whole pattern again
+ * for every candidate, the routes of these pairs are removed from the
+ * loads of their levels and added again with the new hosts. The loads of
+ * every level are kept in a bucket queue (cong_queue_t), so the score of
+ * a candidate costs O(pairs of the two ranks * hops).
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <cgraph.h>
+#include <mpi.h>
+#include "pattern_generator.hpp"
+#include "simulator.hpp"
+#include "topology.hpp"
+#include "routing.hpp"
+#include "placement.hpp"
+
+/* Walks the forwarding tables from src to dst, returns false if there is
+ * no valid route. Unlike find_route this does not report broken routes,
+ * the placement counts them in pl->broken. */
+static bool walk_route(IN hostid_t src, IN hostid_t dst, OUT uroute_t *route) {
+	nodeid_t cur = mytopology.host_node[src];
+	nodeid_t dest = mytopology.host_node[dst];
+
+	route->clear();
+	while (cur != dest) {
+		edgeid_t edgeid = get_next_hop(&mytopology, cur, dst);
+
+		/* a loop free route visits every node at most once */
+		if ((edgeid < 0) || ((int) route->size() >= get_num_nodes()))
+			return false;
+		route->push_back(edgeid);
+		cur = mytopology.edge_head[edgeid];
+	}
+	return true;
+}
+
+/* The route from src to dst out of the route trees, the forwarding tables
+ * are only walked for the pairs the trees do not cover */
+static bool get_pair_route(IN hostid_t src, IN hostid_t dst, OUT uroute_t *route) {
+	route->clear();
+	if (route_trees_lookup(route, src, dst))
+		return true;
+	return walk_route(src, dst, route);
+}
+
+/* Adds delta to the loads of the route of pair p */
+static bool add_pair_load(placement_t *pl, namelist_t *namelist, int p, int delta) {
+	cong_queue_t *q = &pl->levels[pl->level[p]];
+	uroute_t route;
+
+	if (!get_pair_route(namelist->at(pl->src[p]), namelist->at(pl->dst[p]), &route))
+		return false;
+	for (uroute_t::iterator iter = route.begin(); iter != route.end(); ++iter)
+		cong_queue_add(q, *iter, delta);
+	return true;
+}
+
+void placement_init(OUT placement_t *pl, IN cmdargs_t *cmdargs, IN namelist_t *namelist, int mynode) {
+	int level = cmdargs->args_info.ptrn_level_arg;
+	int num_ranks = namelist->size();
+	int p, r;
+
+	if (level < 0) level = 0;
+
+	pl->src.clear();
+	pl->dst.clear();
+	pl->level.clear();
+
+	/* All levels of the pattern, in the same way the simulation runs them.
+	 * The processes compare the scores of their searches, so they have to
+	 * start from the same pairs: process 0 generates the pattern (some
+	 * patterns draw their pairs at random) and sends it to the others. */
+	int sizes[2] = {0, 0};  /* pairs, levels */
+	if (mynode == 0) {
+		while (true) {
+			ptrn_t ptrn;
+
+			genptrn_by_name(&ptrn, cmdargs->args_info.ptrn_arg, cmdargs->ptrnarg,
+			                cmdargs->args_info.commsize_arg, cmdargs->args_info.part_commsize_arg,
+			                level, mynode);
+			if (ptrn.size() == 0 || (cmdargs->args_info.ptrn_level_arg > -1 && level > cmdargs->args_info.ptrn_level_arg)) {break;}
+
+			for (ptrn_t::iterator iter = ptrn.begin(); iter != ptrn.end(); ++iter) {
+				pl->src.push_back(iter->first);
+				pl->dst.push_back(iter->second);
+				pl->level.push_back(sizes[1]);
+			}
+			sizes[1]++;
+			level++;
+		}
+		sizes[0] = pl->src.size();
+	}
+	MPI_Bcast(sizes, 2, MPI_INT, 0, MPI_COMM_WORLD);
+	pl->src.resize(sizes[0]);
+	pl->dst.resize(sizes[0]);
+	pl->level.resize(sizes[0]);
+	if (sizes[0] > 0) {
+		MPI_Bcast(&pl->src[0], sizes[0], MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&pl->dst[0], sizes[0], MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&pl->level[0], sizes[0], MPI_INT, 0, MPI_COMM_WORLD);
+	}
+	pl->levels.assign(sizes[1], cong_queue_t());
+
+	/* the pairs of every rank in CSR form, a pair with the same source and
+	 * destination rank is listed once */
+	pl->rank_offset.assign(num_ranks + 1, 0);
+	for (p = 0; p < (int) pl->src.size(); p++) {
+		pl->rank_offset[pl->src[p] + 1]++;
+		if (pl->dst[p] != pl->src[p]) pl->rank_offset[pl->dst[p] + 1]++;
+	}
+	for (r = 0; r < num_ranks; r++)
+		pl->rank_offset[r + 1] += pl->rank_offset[r];
+	pl->rank_pairs.resize(pl->rank_offset[num_ranks]);
+	std::vector<int> fill(pl->rank_offset.begin(), pl->rank_offset.end() - 1);
+	for (p = 0; p < (int) pl->src.size(); p++) {
+		pl->rank_pairs[fill[pl->src[p]]++] = p;
+		if (pl->dst[p] != pl->src[p]) pl->rank_pairs[fill[pl->dst[p]]++] = p;
+	}
+
+	pl->pair_stamp.assign(pl->src.size(), 0);
+	pl->level_stamp.assign(pl->levels.size(), 0);
+	pl->level_max.assign(pl->levels.size(), 0);
+	pl->epoch = 0;
+
+	/* the loads of the start placement. The congestion of a level is at
+	 * most its number of pairs, so a broken pair costs more than all
+	 * congestion together and the search never trades a route for less
+	 * congestion. */
+	pl->broken = 0;
+	pl->broken_cost = (long) pl->src.size() + 1;
+	for (size_t l = 0; l < pl->levels.size(); l++)
+		cong_queue_init(&pl->levels[l]);
+	for (p = 0; p < (int) pl->src.size(); p++) {
+		if (!add_pair_load(pl, namelist, p, 1))
+			pl->broken++;
+	}
+
+	pl->score = 0;
+	for (size_t l = 0; l < pl->levels.size(); l++)
+		pl->score += cong_queue_max(&pl->levels[l]);
+}
+
+/* Places rank a on the host of rank b and the other way round */
+void placement_swap(IN OUT placement_t *pl, IN OUT namelist_t *namelist, int a, int b) {
+	int ranks[2] = {a, b};
+	int i, k;
+
+	/* the pairs that change, each one once */
+	pl->swap_pairs.clear();
+	pl->epoch++;
+	for (k = 0; k < 2; k++) {
+		for (i = pl->rank_offset[ranks[k]]; i < pl->rank_offset[ranks[k] + 1]; i++) {
+			int p = pl->rank_pairs[i];
+			int l = pl->level[p];
+
+			if (pl->pair_stamp[p] == pl->epoch)
+				continue;
+			pl->pair_stamp[p] = pl->epoch;
+			pl->swap_pairs.push_back(p);
+			if (pl->level_stamp[l] != pl->epoch) {
+				pl->level_stamp[l] = pl->epoch;
+				pl->level_max[l] = cong_queue_max(&pl->levels[l]);
+			}
+		}
+	}
+
+	for (i = 0; i < (int) pl->swap_pairs.size(); i++) {
+		if (!add_pair_load(pl, namelist, pl->swap_pairs[i], -1))
+			pl->broken--;
+	}
+	std::swap(namelist->at(a), namelist->at(b));
+	for (i = 0; i < (int) pl->swap_pairs.size(); i++) {
+		if (!add_pair_load(pl, namelist, pl->swap_pairs[i], 1))
+			pl->broken++;
+	}
+
+	for (i = 0; i < (int) pl->swap_pairs.size(); i++) {
+		int l = pl->level[pl->swap_pairs[i]];
+
+		/* every changed level once */
+		if (pl->level_stamp[l] != pl->epoch)
+			continue;
+		pl->level_stamp[l] = pl->epoch - 1;
+		pl->score += cong_queue_max(&pl->levels[l]) - pl->level_max[l];
+	}
+}
+
+/* What the search minimizes: the score plus the cost of the broken pairs */
+static long placement_cost(placement_t *pl) {
+	return pl->score + pl->broken * pl->broken_cost;
+}
+
+void optimize_placement(IN cmdargs_t *cmdargs, IN OUT namelist_t *namelist,
+                        IN std::vector<int_pair_t> *ranges, FILE *fd, int mynode, int allnodes) {
+	placement_t pl;
+	namelist_t best_namelist;
+	long initial_score, initial_broken, best_cost;
+	long accepted = 0;
+	int steps = cmdargs->args_info.opt_steps_arg;
+	double temp = cmdargs->args_info.opt_temp_arg;
+	MTRand mtrand;
+	int step, movable = 0;
+
+	placement_init(&pl, cmdargs, namelist, mynode);
+	initial_score = pl.score;
+	initial_broken = pl.broken;
+	best_cost = placement_cost(&pl);
+	best_namelist = *namelist;
+
+	for (size_t r = 0; r < ranges->size(); r++)
+		if ((*ranges)[r].second > 1) movable += (*ranges)[r].second;
+
+	/* The temperature falls geometrically to a thousandth of the start
+	 * temperature over the steps, a swap that makes the score worse by
+	 * delta is accepted with probability exp(-delta / temperature). Every
+	 * process runs its own search. */
+	double cooling = (steps > 0) ? pow(0.001, 1.0 / steps) : 1.0;
+	for (step = 0; (step < steps) && (movable > 0); step++, temp *= cooling) {
+		int pick = mtrand.randInt(movable - 1);
+		int first, count, a, b;
+		size_t r;
+
+		/* two different ranks out of the same range */
+		for (r = 0; r < ranges->size(); r++) {
+			if ((*ranges)[r].second < 2) continue;
+			if (pick < (*ranges)[r].second) break;
+			pick -= (*ranges)[r].second;
+		}
+		first = (*ranges)[r].first;
+		count = (*ranges)[r].second;
+		a = first + pick;
+		b = first + mtrand.randInt(count - 2);
+		if (b >= a) b++;
+
+		long old_cost = placement_cost(&pl);
+		placement_swap(&pl, namelist, a, b);
+		long delta = placement_cost(&pl) - old_cost;
+
+		if ((delta <= 0) || (mtrand.rand() < exp(-delta / temp))) {
+			accepted++;
+			if (placement_cost(&pl) < best_cost) {
+				best_cost = placement_cost(&pl);
+				best_namelist = *namelist;
+			}
+		} else {
+			placement_swap(&pl, namelist, a, b);
+		}
+	}
+	namelist->swap(best_namelist);
+
+	/* the best placement of all processes */
+	struct { long cost; int rank; } mybest = {best_cost, mynode}, best;
+	MPI_Allreduce(&mybest, &best, 1, MPI_LONG_INT, MPI_MINLOC, MPI_COMM_WORLD);
+	if (!namelist->empty())
+		MPI_Bcast(&namelist->at(0), namelist->size(), MPI_INT, best.rank, MPI_COMM_WORLD);
+	long best_broken = best.cost / pl.broken_cost;
+	long best_score = best.cost % pl.broken_cost;
+
+	if (mynode == 0) {
+		printf("Placement optimization: %d swaps on each of %d processes (%ld accepted on process 0)\n",
+		       steps, allnodes, accepted);
+		printf("  Pairs without a valid route: %ld at the start, %ld at best\n", initial_broken, best_broken);
+		printf("  Sum of the maximum congestions of all %zu levels: %ld at the start, %ld at best (process %d)\n",
+		       pl.levels.size(), initial_score, best_score, best.rank);
+
+		/* the result can be read back with --node_ordering_file */
+		fprintf(fd, "# Placement of %zu ranks, sum of the maximum congestions of all levels: %ld\n",
+		        namelist->size(), best_score);
+		for (size_t r = 0; r < namelist->size(); r++)
+			fprintf(fd, "%#llx # rank %zu, %s\n", convert_nodename_to_guid(get_host_name(namelist->at(r))),
+			        r, get_host_name(namelist->at(r)));
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <vector>
+#include <stdio.h>
+#include "simulator.hpp"
+
+/* The state of the placement search: the pairs of all levels of the
+ * pattern (by rank, the same on all processes), the pairs every rank takes
+ * part in and the loads of every level in a bucket queue, so that the
+ * maximum congestion of a level is known after every change. score is the
+ * sum of the maximum congestions of all levels (what sum_max_cong accounts
+ * for one run), the search adds broken_cost for every broken pair to it. */
+typedef struct {
+	std::vector<cong_queue_t> levels;
+	std::vector<int> src;           /* pair -> source rank */
+	std::vector<int> dst;           /* pair -> destination rank */
+	std::vector<int> level;         /* pair -> level */
+	std::vector<int> rank_offset;   /* rank -> first entry in rank_pairs, num_ranks + 1 entries */
+	std::vector<int> rank_pairs;    /* the pairs of every rank */
+	std::vector<unsigned int> pair_stamp;   /* pair -> last swap that rerouted it */
+	std::vector<unsigned int> level_stamp;  /* level -> last swap that changed it */
+	std::vector<int> level_max;     /* level -> maximum load before the current swap */
+	std::vector<int> swap_pairs;    /* the pairs the current swap reroutes */
+	unsigned int epoch;
+	long score;
+	long broken;                    /* pairs without a valid route, they add no load */
+	long broken_cost;               /* the cost of one broken pair, more than any score */
+} placement_t;
+
+/* prototypes */
+void placement_init(OUT placement_t *pl, IN cmdargs_t *cmdargs, IN namelist_t *namelist, int mynode);
+void placement_swap(IN OUT placement_t *pl, IN OUT namelist_t *namelist, int a, int b);
+void optimize_placement(IN cmdargs_t *cmdargs, IN OUT namelist_t *namelist,
+                        IN std::vector<int_pair_t> *ranges, FILE *fd, int mynode, int allnodes);
+
+#endif
@@ -0,0 +1,995 @@
+/*
+ * Copyright (c) 2009 The Trustees of Indiana University and Indiana
+ *                    University Research and Technology
+ *                    Corporation.  All rights reserved.
+ *
+ * Author(s): Timo Schneider <timoschn@cs.indiana.edu>
+ *            Torsten Hoefler <htor@cs.indiana.edu>
+ *
+ */
+
+/* The metrics walk the routes of a pattern level through the forwarding
+ * tables in batches and record them in a route arena, so the maximum
+ * congestion along each route is found without routing a second time (see
+ * add_lane_blocks). find_route is left for the pairs the batches can not
+ * handle and for the analyses that route single pairs. The same host pairs
+ * come up again and again there, so find_route keeps the routes it computed
+ * in a route store: if the per-destination route trees of all hosts fit
+ * into the memory budget they are built up front, otherwise every thread
+ * caches the routes it computes.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cgraph.h>
+#include <mpi.h>
+#include "simulator.hpp"
+#include "topology.hpp"
+#include "routing.hpp"
+
+route_trees_t myroutetrees;
+static size_t route_cache_budget;           /* of the process, in bytes */
+static int route_cache_threads = 1;
+static thread_local route_cache_t myroutecache;
+static thread_local bool myroutecache_ready = false;
+static thread_local route_store_stats_t mystats;
+static route_store_stats_t route_store_totals;
+
+static inline size_t route_cache_slot(unsigned long long key) {
+	return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> myroutecache.shift);
+}
+
+void init_route_store(size_t budget) {
+	size_t trees_size = (size_t) get_num_hosts() * get_num_switches() * (sizeof(edgeid_t) + 1);
+
+	myroutetrees = route_trees_t();
+	if ((budget > 0) && (trees_size <= budget)) {
+		build_route_trees();
+		route_cache_init(0);
+	} else {
+		route_cache_init(budget);
+	}
+}
+
+void route_cache_init(size_t budget) {
+	route_cache_budget = budget;
+	route_store_totals = route_store_stats_t();
+}
+
+/* The number of threads that share the budget of the process */
+void route_cache_set_threads(int threads) {
+	route_cache_threads = std::max(1, threads);
+}
+
+/* Sizes the cache of the calling thread to its share of the budget */
+static void route_cache_setup() {
+	size_t budget = route_cache_budget / route_cache_threads;
+	size_t slots = 1;
+	int bits = 0;
+
+	myroutecache_ready = true;
+	myroutecache = route_cache_t();
+	myroutecache.budget = budget;
+
+	/* Give the hash table roughly a quarter of the budget, an entry takes
+	 * ROUTE_CACHE_SLOT_BYTES in the table. The rest is left for the arena. */
+	while ((slots * 2) * ROUTE_CACHE_SLOT_BYTES <= budget / 4) {
+		slots *= 2;
+		bits++;
+	}
+	if (bits < 4) {
+		/* too small to be of any use */
+		myroutecache.budget = 0;
+		return;
+	}
+	myroutecache.shift = 64 - bits;
+	myroutecache.keys.assign(slots, ROUTE_CACHE_EMPTY);
+	myroutecache.offsets.assign(slots, 0);
+	myroutecache.lengths.assign(slots, 0);
+}
+
+static bool route_cache_find(OUT uroute_t *route, IN hostid_t src, IN hostid_t dst) {
+	unsigned long long key = ((unsigned long long) src << 32) | (unsigned int) dst;
+	size_t mask = myroutecache.keys.size() - 1;
+	size_t slot;
+
+	for (slot = route_cache_slot(key); myroutecache.keys[slot] != ROUTE_CACHE_EMPTY; slot = (slot + 1) & mask) {
+		if (myroutecache.keys[slot] == key) {
+			edgeid_t *first = myroutecache.arena.data() + myroutecache.offsets[slot];
+			route->assign(first, first + myroutecache.lengths[slot]);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void route_cache_add(IN hostid_t src, IN hostid_t dst, IN uroute_t *route) {
+	unsigned long long key = ((unsigned long long) src << 32) | (unsigned int) dst;
+	size_t mask = myroutecache.keys.size() - 1;
+	size_t used, slot;
+
+	/* keep the load factor of the table below 1/2 and stay within the budget */
+	used = myroutecache.keys.size() * ROUTE_CACHE_SLOT_BYTES + (myroutecache.arena.size() + route->size()) * sizeof(edgeid_t);
+	if ((myroutecache.entries + 1 > myroutecache.keys.size() / 2) || (used > myroutecache.budget) ||
+	    (route->size() > 255)) {
+		mystats.rejected++;
+		return;
+	}
+
+	for (slot = route_cache_slot(key); myroutecache.keys[slot] != ROUTE_CACHE_EMPTY; slot = (slot + 1) & mask) {
+		if (myroutecache.keys[slot] == key) return;
+	}
+
+	/* do not let the arena double its capacity beyond the budget */
+	if (myroutecache.arena.size() + route->size() > myroutecache.arena.capacity()) {
+		size_t maxedges = (myroutecache.budget - myroutecache.keys.size() * ROUTE_CACHE_SLOT_BYTES) / sizeof(edgeid_t);
+		myroutecache.arena.reserve(std::max(myroutecache.arena.size() + route->size(),
+		                                    std::min(maxedges, 2 * myroutecache.arena.capacity())));
+	}
+
+	myroutecache.keys[slot] = key;
+	myroutecache.offsets[slot] = myroutecache.arena.size();
+	myroutecache.lengths[slot] = route->size();
+	myroutecache.arena.insert(myroutecache.arena.end(), route->begin(), route->end());
+	myroutecache.entries++;
+	mystats.cached++;
+}
+
+bool route_cache_lookup(OUT uroute_t *route, IN hostid_t src, IN hostid_t dst) {
+	if (route_cache_budget == 0)
+		return false;
+
+	if (!myroutecache.keys.empty() && route_cache_find(route, src, dst)) {
+		mystats.hits++;
+		return true;
+	}
+	mystats.misses++;
+	return false;
+}
+
+void route_cache_insert(IN hostid_t src, IN hostid_t dst, IN uroute_t *route) {
+	if (route_cache_budget == 0)
+		return;
+
+	if (!myroutecache_ready)
+		route_cache_setup();
+	if (myroutecache.budget == 0)
+		return;
+	route_cache_add(src, dst, route);
+}
+
+/* Adds the counters of the calling thread to the totals of the process */
+void route_store_flush_stats() {
+	__sync_fetch_and_add(&route_store_totals.hits, mystats.hits);
+	__sync_fetch_and_add(&route_store_totals.misses, mystats.misses);
+	__sync_fetch_and_add(&route_store_totals.rejected, mystats.rejected);
+	__sync_fetch_and_add(&route_store_totals.cached, mystats.cached);
+	__sync_fetch_and_add(&route_store_totals.tree_lookups, mystats.tree_lookups);
+	mystats = route_store_stats_t();
+}
+
+/* Fills next and hops (num_switches entries each) with the route tree of the
+ * destination host dst. state and stack are scratch space. */
+static void resolve_route_tree(IN hostid_t dst, OUT edgeid_t *next, OUT unsigned char *hops,
+                               std::vector<unsigned char> *state, std::vector<int> *stack) {
+	int num_switches = get_num_switches();
+	nodeid_t dest = mytopology.host_node[dst];
+	int sw;
+
+	for (sw = 0; sw < num_switches; sw++)
+		next[sw] = get_next_hop(&mytopology, mytopology.switch_node[sw], dst);
+
+	/* Resolve the hop counts: follow the parent pointers from every
+	 * switch that is not resolved yet until we reach the destination,
+	 * a resolved switch or something broken, then unwind the path. A
+	 * switch we meet again on the same path is part of a loop.
+	 * state: 0 unknown, 1 on the current path, 2 resolved */
+	state->assign(num_switches, 0);
+	for (sw = 0; sw < num_switches; sw++) {
+		int cur = sw;
+		int left;
+
+		stack->clear();
+		while (true) {
+			if ((*state)[cur] == 2) { left = hops[cur]; break; }
+			if ((*state)[cur] == 1) { left = ROUTE_TREE_BROKEN; break; }
+			(*state)[cur] = 1;
+			stack->push_back(cur);
+
+			if (next[cur] < 0) { left = ROUTE_TREE_BROKEN; break; }
+			nodeid_t head = mytopology.edge_head[next[cur]];
+			if (head == dest) { left = 0; break; }
+			cur = mytopology.switch_index[head];
+			/* detours over other hosts are left to find_route */
+			if (cur < 0) { left = ROUTE_TREE_BROKEN; break; }
+		}
+
+		/* left is the number of hops after the last switch on the stack */
+		while (!stack->empty()) {
+			cur = stack->back();
+			stack->pop_back();
+			if ((left != ROUTE_TREE_BROKEN) && (left + 1 < ROUTE_TREE_BROKEN))
+				left = left + 1;
+			else
+				left = ROUTE_TREE_BROKEN;
+			hops[cur] = left;
+			(*state)[cur] = 2;
+		}
+	}
+}
+
+void build_route_trees() {
+	int num_switches = get_num_switches();
+	int num_hosts = get_num_hosts();
+	std::vector<unsigned char> state;
+	std::vector<int> stack;
+	hostid_t dst;
+
+	myroutetrees.num_switches = num_switches;
+	myroutetrees.next.assign((size_t) num_hosts * num_switches, -1);
+	myroutetrees.hops.assign((size_t) num_hosts * num_switches, ROUTE_TREE_BROKEN);
+
+	for (dst = 0; dst < num_hosts; dst++) {
+		size_t base = (size_t) dst * num_switches;
+		resolve_route_tree(dst, &myroutetrees.next[base], &myroutetrees.hops[base], &state, &stack);
+	}
+}
+
+bool route_trees_lookup(OUT uroute_t *route, IN hostid_t src, IN hostid_t dst) {
+	nodeid_t start, dest;
+	edgeid_t edgeid;
+	int sw, left;
+
+	if (myroutetrees.next.empty())
+		return false;
+
+	start = mytopology.host_node[src];
+	dest = mytopology.host_node[dst];
+	if (start == dest) {
+		mystats.tree_lookups++;
+		return true;
+	}
+
+	/* the first hop leaves the source host, the rest is in the tree */
+	edgeid = get_next_hop(&mytopology, start, dst);
+	if (edgeid < 0)
+		return false;
+	if (mytopology.edge_head[edgeid] == dest) {
+		route->push_back(edgeid);
+		mystats.tree_lookups++;
+		return true;
+	}
+	sw = mytopology.switch_index[mytopology.edge_head[edgeid]];
+	if (sw < 0)
+		return false;
+
+	size_t base = (size_t) dst * myroutetrees.num_switches;
+	left = myroutetrees.hops[base + sw];
+	if (left == ROUTE_TREE_BROKEN)
+		return false;
+
+	route->push_back(edgeid);
+	while (left-- > 0) {
+		edgeid = myroutetrees.next[base + sw];
+		route->push_back(edgeid);
+		sw = mytopology.switch_index[mytopology.edge_head[edgeid]];
+	}
+	mystats.tree_lookups++;
+	return true;
+}
+
+void print_route_cache_stats(FILE *fd, int mynode, int allnodes) {
+	unsigned long long local[5], global[5];
+
+	/* the other threads are done and have flushed their counters */
+	route_store_flush_stats();
+	local[0] = route_store_totals.hits;
+	local[1] = route_store_totals.misses;
+	local[2] = route_store_totals.rejected;
+	local[3] = route_store_totals.cached;
+	local[4] = route_store_totals.tree_lookups;
+	MPI_Reduce(local, global, 5, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if (mynode == 0) {
+		if (!myroutetrees.next.empty()) {
+			fprintf(fd, "Route trees: %d destinations x %d switches (%.1f MB per rank), %llu routes read from the trees\n",
+			        get_num_hosts(), myroutetrees.num_switches,
+			        myroutetrees.next.size() * (sizeof(edgeid_t) + 1) / (1024.0 * 1024.0), global[4]);
+		}
+		fprintf(fd, "Route cache: %llu hits, %llu misses (%.2f%% hit rate), %llu routes cached on %d ranks, %llu not cached (budget exhausted)\n",
+		        global[0], global[1], (global[0] + global[1]) ? 100.0 * global[0] / (global[0] + global[1]) : 0.0,
+		        global[3], allnodes, global[2]);
+	}
+}
+
+/* All-to-all evaluation
+ *
+ * In a complete exchange among the hosts of a namelist every link carries
+ * one unit per pair whose route uses it. Instead of walking all N^2 routes
+ * we look at one destination at a time: the routes of all sources towards
+ * it form the route tree of that destination, so the load of a tree edge is
+ * the number of sources below it. Counting the sources attached to each
+ * switch and pushing the counts towards the root (switches in order of
+ * decreasing distance) gives the loads of all links towards the destination
+ * in O(switches). The uplinks of the hosts carry one unit per reachable
+ * destination, which is counted per switch and added at the end.
+ *
+ * Hosts that are not attached to a switch by a single uplink and sources
+ * whose switch can not reach the destination through the tree (loops,
+ * missing entries) are routed pair by pair with find_route, so they are
+ * reported and counted exactly as before.
+ */
+
+typedef struct {
+	std::vector<int> uplink;            /* host id -> switch id of its uplink, -1 if not attached */
+	std::vector<int> attached_offset;   /* switch id -> first host in attached, num_switches + 1 entries */
+	std::vector<hostid_t> attached;     /* namelist hosts attached by a single uplink, by switch */
+	std::vector<hostid_t> special;      /* all other namelist hosts */
+} a2a_hosts_t;
+
+typedef struct {
+	edgeid_t *next;                     /* route tree of the current destination */
+	unsigned char *hops;
+	std::vector<edgeid_t> next_buf;     /* used if the route trees are not built */
+	std::vector<unsigned char> hops_buf;
+	std::vector<unsigned char> state;
+	std::vector<int> stack;
+	std::vector<int> order;             /* switches that reach the destination, by distance */
+	std::vector<int> bucket;
+} a2a_tree_t;
+
+static void a2a_classify_hosts(IN namelist_t *namelist, OUT a2a_hosts_t *hosts) {
+	int num_switches = get_num_switches();
+	namelist_t::iterator iter;
+	int sw;
+
+	hosts->uplink.assign(get_num_hosts(), -1);
+	hosts->attached_offset.assign(num_switches + 1, 0);
+	hosts->attached.resize(namelist->size());
+	hosts->special.clear();
+
+	for (iter = namelist->begin(); iter != namelist->end(); ++iter) {
+		nodeid_t node = mytopology.host_node[*iter];
+		edgeid_t edgeid = mytopology.fwd_uniform[node];
+
+		if ((mytopology.fwd_offset[node] < 0) && (edgeid >= 0) &&
+		    (mytopology.switch_index[mytopology.edge_head[edgeid]] >= 0)) {
+			hosts->uplink[*iter] = mytopology.switch_index[mytopology.edge_head[edgeid]];
+			hosts->attached_offset[hosts->uplink[*iter] + 1]++;
+		} else {
+			hosts->special.push_back(*iter);
+		}
+	}
+	for (sw = 0; sw < num_switches; sw++)
+		hosts->attached_offset[sw + 1] += hosts->attached_offset[sw];
+
+	std::vector<int> fill(hosts->attached_offset.begin(), hosts->attached_offset.end() - 1);
+	for (iter = namelist->begin(); iter != namelist->end(); ++iter) {
+		if (hosts->uplink[*iter] >= 0)
+			hosts->attached[fill[hosts->uplink[*iter]]++] = *iter;
+	}
+	hosts->attached.resize(hosts->attached_offset[num_switches]);
+}
+
+/* Loads the route tree of dst and sorts the switches that reach dst by
+ * their distance (counting sort, the distance is below ROUTE_TREE_BROKEN) */
+static void a2a_load_tree(IN hostid_t dst, OUT a2a_tree_t *tree) {
+	int num_switches = get_num_switches();
+	int sw, h;
+
+	if (!myroutetrees.next.empty()) {
+		tree->next = &myroutetrees.next[(size_t) dst * num_switches];
+		tree->hops = &myroutetrees.hops[(size_t) dst * num_switches];
+	} else {
+		tree->next_buf.resize(num_switches);
+		tree->hops_buf.resize(num_switches);
+		tree->next = &tree->next_buf[0];
+		tree->hops = &tree->hops_buf[0];
+		resolve_route_tree(dst, tree->next, tree->hops, &tree->state, &tree->stack);
+	}
+
+	tree->bucket.assign(ROUTE_TREE_BROKEN + 1, 0);
+	for (sw = 0; sw < num_switches; sw++)
+		tree->bucket[tree->hops[sw] + 1]++;
+	for (h = 0; h < ROUTE_TREE_BROKEN; h++)
+		tree->bucket[h + 1] += tree->bucket[h];
+	tree->order.resize(tree->bucket[ROUTE_TREE_BROKEN]);
+	for (sw = 0; sw < num_switches; sw++)
+		if (tree->hops[sw] != ROUTE_TREE_BROKEN)
+			tree->order[tree->bucket[tree->hops[sw]]++] = sw;
+}
+
+/* Routes the pair src -> dst the slow way and adds its route to the loads */
+static void a2a_add_pair_load(IN hostid_t src, IN hostid_t dst, OUT std::vector<int> *loads) {
+	uroute_t route;
+
+	find_route(&route, src, dst);
+	for (uroute_t::iterator iter = route.begin(); iter != route.end(); ++iter)
+		(*loads)[*iter]++;
+}
+
+/* Routes the pair src -> dst the slow way and returns the maximum load of
+ * the route without its first and last edge */
+static int a2a_get_pair_max_load(IN hostid_t src, IN hostid_t dst, IN std::vector<int> *loads) {
+	uroute_t route;
+	int max = 0;
+
+	find_route(&route, src, dst);
+	for (uroute_t::iterator iter = route.begin(); iter != route.end(); ++iter) {
+		if ((iter != route.begin()) && ((iter + 1) != route.end()))
+			if ((*loads)[*iter] > max) max = (*loads)[*iter];
+	}
+	return max;
+}
+
+void all_to_all_link_loads(IN namelist_t *namelist, IN int first, IN int count, OUT std::vector<int> *loads) {
+	int num_switches = get_num_switches();
+	std::vector<int> reachable(num_switches, 0);
+	std::vector<int> sources(num_switches);
+	std::vector<char> self(get_num_hosts(), 0);
+	std::vector<hostid_t>::iterator iter;
+	a2a_hosts_t hosts;
+	a2a_tree_t tree;
+	int i, sw;
+
+	loads->assign(get_num_edges(), 0);
+	a2a_classify_hosts(namelist, &hosts);
+
+	for (i = first; i < first + count; i++) {
+		hostid_t dst = namelist->at(i);
+		nodeid_t dest = mytopology.host_node[dst];
+
+		a2a_load_tree(dst, &tree);
+
+		/* sources that enter the tree at each switch */
+		for (sw = 0; sw < num_switches; sw++) {
+			sources[sw] = hosts.attached_offset[sw + 1] - hosts.attached_offset[sw];
+			if ((tree.hops[sw] == ROUTE_TREE_BROKEN) && (sources[sw] > 0)) {
+				for (int k = hosts.attached_offset[sw]; k < hosts.attached_offset[sw + 1]; k++)
+					if (hosts.attached[k] != dst) a2a_add_pair_load(hosts.attached[k], dst, loads);
+				sources[sw] = 0;
+			}
+		}
+		if (hosts.uplink[dst] >= 0) {
+			sources[hosts.uplink[dst]]--;
+			if (tree.hops[hosts.uplink[dst]] != ROUTE_TREE_BROKEN) self[dst] = 1;
+		}
+		for (iter = hosts.special.begin(); iter != hosts.special.end(); ++iter)
+			if (*iter != dst) a2a_add_pair_load(*iter, dst, loads);
+
+		/* push the counts towards the destination */
+		for (int k = tree.order.size() - 1; k >= 0; k--) {
+			edgeid_t edgeid = tree.next[tree.order[k]];
+			nodeid_t head = mytopology.edge_head[edgeid];
+
+			sw = tree.order[k];
+			(*loads)[edgeid] += sources[sw];
+			if (head != dest) sources[mytopology.switch_index[head]] += sources[sw];
+			reachable[sw]++;
+		}
+	}
+
+	/* every host sends one unit over its uplink to each destination its
+	 * switch reaches, except to itself */
+	for (iter = hosts.attached.begin(); iter != hosts.attached.end(); ++iter) {
+		edgeid_t edgeid = mytopology.fwd_uniform[mytopology.host_node[*iter]];
+		(*loads)[edgeid] += reachable[hosts.uplink[*iter]] - self[*iter];
+	}
+}
+
+void all_to_all_max_loads(IN namelist_t *namelist, IN int first, IN int count,
+                          IN std::vector<int> *loads, OUT std::map<int, int> *bins) {
+	int num_switches = get_num_switches();
+	std::vector<int> max(num_switches);
+	std::vector<hostid_t>::iterator iter;
+	a2a_hosts_t hosts;
+	a2a_tree_t tree;
+	int i, sw;
+
+	a2a_classify_hosts(namelist, &hosts);
+
+	for (i = first; i < first + count; i++) {
+		hostid_t dst = namelist->at(i);
+		nodeid_t dest = mytopology.host_node[dst];
+
+		a2a_load_tree(dst, &tree);
+
+		/* the route to itself is empty */
+		(*bins)[0]++;
+
+		/* maximum load on the way from each switch to the destination,
+		 * without the last edge; the uplink of the source does not count
+		 * either */
+		for (int k = 0; k < (int) tree.order.size(); k++) {
+			edgeid_t edgeid = tree.next[tree.order[k]];
+			nodeid_t head = mytopology.edge_head[edgeid];
+			int n;
+
+			sw = tree.order[k];
+			if (head == dest)
+				max[sw] = 0;
+			else
+				max[sw] = std::max((*loads)[edgeid], max[mytopology.switch_index[head]]);
+
+			n = hosts.attached_offset[sw + 1] - hosts.attached_offset[sw];
+			if (hosts.uplink[dst] == sw) n--;
+			if (n > 0) (*bins)[max[sw]] += n;
+		}
+
+		for (sw = 0; sw < num_switches; sw++) {
+			if (tree.hops[sw] != ROUTE_TREE_BROKEN) continue;
+			for (int k = hosts.attached_offset[sw]; k < hosts.attached_offset[sw + 1]; k++)
+				if (hosts.attached[k] != dst) (*bins)[a2a_get_pair_max_load(hosts.attached[k], dst, loads)]++;
+		}
+		for (iter = hosts.special.begin(); iter != hosts.special.end(); ++iter)
+			if (*iter != dst) (*bins)[a2a_get_pair_max_load(*iter, dst, loads)]++;
+	}
+}
+
+/* Route validation
+ *
+ * check_routes walks the forwarding tables of every node towards one
+ * destination at a time. Nodes are colored as they are visited, so every
+ * node is followed only once per destination no matter how many sources
+ * route through it: the walk from a source stops at the first node whose
+ * outcome is known already and all nodes on the way inherit it. Routing
+ * loops are found as nodes that are met again on the current walk.
+ */
+
+typedef struct {
+	std::vector<unsigned char> state;   /* 0 unknown, 1 on the current walk, 2 resolved */
+	std::vector<int> hops;              /* edges left to the destination, -1 if broken */
+	std::vector<unsigned char> problem; /* ROUTE_DEAD_END or ROUTE_LOOP if broken */
+	std::vector<nodeid_t> where;        /* node without an entry or node on the loop */
+	std::vector<nodeid_t> walk;
+} route_walk_t;
+
+static void check_destination(IN hostid_t dst, route_walk_t *w, OUT route_check_t *check) {
+	nodeid_t dest = mytopology.host_node[dst];
+	int num_hosts = get_num_hosts();
+	hostid_t src;
+
+	std::fill(w->state.begin(), w->state.end(), 0);
+	w->state[dest] = 2;
+	w->hops[dest] = 0;
+
+	for (src = 0; src < num_hosts; src++) {
+		nodeid_t cur = mytopology.host_node[src];
+		int hops, problem = 0;
+		nodeid_t where = -1;
+
+		if (src == dst) continue;
+
+		w->walk.clear();
+		while (true) {
+			if (w->state[cur] == 2) {
+				hops = w->hops[cur];
+				problem = w->problem[cur];
+				where = w->where[cur];
+				break;
+			}
+			if (w->state[cur] == 1) {
+				hops = -1;
+				problem = ROUTE_LOOP;
+				where = cur;
+				break;
+			}
+			w->state[cur] = 1;
+			w->walk.push_back(cur);
+
+			edgeid_t edgeid = get_next_hop(&mytopology, cur, dst);
+			if (edgeid < 0) {
+				hops = -1;
+				problem = ROUTE_DEAD_END;
+				where = cur;
+				break;
+			}
+			cur = mytopology.edge_head[edgeid];
+		}
+
+		/* unwind the walk, hops is the number of edges after the last node */
+		while (!w->walk.empty()) {
+			cur = w->walk.back();
+			w->walk.pop_back();
+			if (hops >= 0) hops++;
+			w->hops[cur] = hops;
+			w->problem[cur] = problem;
+			w->where[cur] = where;
+			w->state[cur] = 2;
+		}
+
+		cur = mytopology.host_node[src];
+		check->pairs++;
+		if (w->hops[cur] >= 0) {
+			if (w->hops[cur] > check->longest) check->longest = w->hops[cur];
+			continue;
+		}
+
+		broken_route_t broken;
+		broken.src = src;
+		broken.dst = dst;
+		broken.problem = w->problem[cur];
+		broken.node = w->where[cur];
+		/* a source without an entry of its own has no route at all */
+		if ((broken.problem == ROUTE_DEAD_END) && (broken.node == cur))
+			broken.problem = ROUTE_MISSING;
+		check->problems[broken.problem]++;
+		check->broken.push_back(broken);
+	}
+}
+
+/* The destinations of check_routes split among threads, every thread
+ * checks a contiguous range into a result of its own */
+typedef struct {
+	hostid_t first;
+	int count;
+	int shards;
+	std::vector<route_check_t> checks;
+} route_check_split_t;
+
+static void check_routes_shard(void *arg, int shard) {
+	route_check_split_t *split = (route_check_split_t *) arg;
+	hostid_t first = split->first + (hostid_t) ((long) split->count * shard / split->shards);
+	hostid_t last = split->first + (hostid_t) ((long) split->count * (shard + 1) / split->shards);
+	int num_nodes = get_num_nodes();
+	route_walk_t w;
+	hostid_t dst;
+
+	w.state.resize(num_nodes);
+	w.hops.resize(num_nodes);
+	w.problem.resize(num_nodes);
+	w.where.resize(num_nodes);
+
+	for (dst = first; dst < last; dst++)
+		check_destination(dst, &w, &split->checks[shard]);
+}
+
+void check_routes(IN hostid_t first, IN int count, IN int threads, OUT route_check_t *check) {
+	route_check_split_t split;
+	int s, i;
+
+	split.first = first;
+	split.count = count;
+	split.shards = std::max(1, std::min(threads, count));
+	split.checks.assign(split.shards, route_check_t());
+	run_parallel(split.shards, check_routes_shard, &split);
+
+	/* the ranges one after the other keep the broken pairs in order */
+	*check = route_check_t();
+	for (s = 0; s < split.shards; s++) {
+		route_check_t *part = &split.checks[s];
+
+		check->pairs += part->pairs;
+		for (i = 0; i < 3; i++)
+			check->problems[i] += part->problems[i];
+		check->longest = std::max(check->longest, part->longest);
+		check->broken.insert(check->broken.end(), part->broken.begin(), part->broken.end());
+	}
+}
+
+void print_route_check(IN route_check_t *check, FILE *summary, FILE *list, int mynode, int allnodes) {
+	const char *names[3] = { "no_route", "dead_end", "loop" };
+	unsigned long long local[4], global[4];
+	int longest, i;
+
+	local[0] = check->pairs;
+	for (i = 0; i < 3; i++)
+		local[i + 1] = check->problems[i];
+	MPI_Reduce(local, global, 4, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce((void *) &check->longest, &longest, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+
+	/* collect the broken pairs on rank 0, four ints each */
+	std::vector<int> sendbuf;
+	for (std::vector<broken_route_t>::iterator iter = check->broken.begin(); iter != check->broken.end(); ++iter) {
+		sendbuf.push_back(iter->src);
+		sendbuf.push_back(iter->dst);
+		sendbuf.push_back(iter->problem);
+		sendbuf.push_back(iter->node);
+	}
+	int sendcount = sendbuf.size();
+	std::vector<int> recvcounts(allnodes), displs(allnodes);
+	MPI_Gather(&sendcount, 1, MPI_INT, &recvcounts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+	int total = 0;
+	for (i = 0; i < allnodes; i++) {
+		displs[i] = total;
+		total += recvcounts[i];
+	}
+	std::vector<int> recvbuf(std::max(total, 1));
+	sendbuf.push_back(0); /* never pass the address of an empty vector */
+	MPI_Gatherv(&sendbuf[0], sendcount, MPI_INT, &recvbuf[0], &recvcounts[0], &displs[0], MPI_INT, 0, MPI_COMM_WORLD);
+
+	if (mynode != 0)
+		return;
+
+	fprintf(list, "# source destination problem node\n");
+	for (i = 0; i < total; i += 4) {
+		fprintf(list, "%s %s %s %s\n", get_host_name(recvbuf[i]), get_host_name(recvbuf[i + 1]),
+		        names[recvbuf[i + 2]], get_node_name(recvbuf[i + 3]));
+	}
+
+	fprintf(summary, "Checked the routes of %llu host pairs on %d ranks\n", global[0], allnodes);
+	fprintf(summary, "         Valid routes: %llu\n", global[0] - global[1] - global[2] - global[3]);
+	fprintf(summary, "       Missing routes: %llu\n", global[1]);
+	fprintf(summary, "            Dead ends: %llu\n", global[2]);
+	fprintf(summary, "        Routing loops: %llu\n", global[3]);
+	fprintf(summary, "  Longest valid route: %d hops\n", longest);
+}
+
+/* Batched route walking
+ *
+ * Following a route is a chain of dependent loads (forwarding table entry,
+ * head of the edge, next table entry), so walking the pairs of a pattern
+ * one after the other spends most of its time waiting for memory. The
+ * pairs are therefore walked in blocks of ROUTE_BATCH_SIZE that advance
+ * one hop at a time: in every step the table entries of all pairs in the
+ * block are prefetched first and used afterwards, so the misses of the
+ * block overlap. A pair whose route is complete adds its edges to the
+ * loads of its lane. If an arena is given, the routes are also recorded
+ * there, so that the metrics can evaluate them a second time without
+ * routing again. Pairs with a broken route (or a route longer than
+ * ROUTE_BATCH_MAX_HOPS) are handed to find_route at the end of the block,
+ * which reports them as usual.
+ *
+ * The pairs may belong to several runs (lanes) that are evaluated
+ * together, see lane_pairs_t. get_lane_pairs interleaves the lanes, so a
+ * block holds the same pattern pairs of all runs; the forwarding rows of
+ * the fabric and the counters of an edge (which are adjacent for all
+ * lanes) are then shared by the whole block instead of being brought into
+ * the cache once per run.
+ *
+ * The kernel is templated on the width of the counters. A route uses an
+ * edge at most once, so one block adds at most ROUTE_BATCH_SIZE to any
+ * counter: the kernel stops after a block that brought a counter within
+ * that distance of saturation, and add_lane_loads widens the counters
+ * before it continues with the next block.
+ *
+ * There is no SIMD gather path. The counter updates are increments at
+ * arbitrary edges, and several pairs of a block often hit the same edge:
+ * that is a scatter with conflicts, which AVX2 can not do (it only has
+ * gathers). A hop could gather the table entries of eight pairs, but it is
+ * three dependent loads of different widths (offset, table entry, head of
+ * the edge) plus the uniform rows, and the gathers would still wait for
+ * the same misses that the prefetches already overlap.
+ */
+
+#define ROUTE_BATCH_SIZE 64
+#define ROUTE_BATCH_MAX_HOPS 32
+
+template <typename T, bool shared>
+static inline bool add_load(T *load, size_t counter, std::vector<size_t> *touched) {
+	/* the threads of a split level share 32 bit counters, the thread
+	 * that brings a counter from 0 to 1 records it as touched */
+	if (shared) {
+		if (__sync_fetch_and_add(&load[counter], 1) == 0)
+			touched->push_back(counter);
+		return false;
+	}
+	if (load[counter] == 0)
+		touched->push_back(counter);
+	return ++load[counter] > (T) (~(T) 0) - ROUTE_BATCH_SIZE;
+}
+
+/* Walks the pairs from first on (up to last), returns where it stopped */
+template <typename T, bool shared>
+static size_t add_lane_blocks(IN lane_pairs_t *pairs, IN size_t first, IN size_t size,
+                              OUT T *load, OUT std::vector<size_t> *touched, OUT route_arena_t *arena) {
+	nodeid_t cur[ROUTE_BATCH_SIZE], dest[ROUTE_BATCH_SIZE];
+	hostid_t dst[ROUTE_BATCH_SIZE];
+	int len[ROUTE_BATCH_SIZE], active[ROUTE_BATCH_SIZE], slow[ROUTE_BATCH_SIZE];
+	int lane[ROUTE_BATCH_SIZE];
+	edgeid_t path[ROUTE_BATCH_SIZE][ROUTE_BATCH_MAX_HOPS];
+	size_t count;
+	int lanes = pairs->lanes;
+	int i, k, num_active, num_slow;
+	bool full = false;
+
+	for (; (first < size) && !full; first += count) {
+		count = std::min((size_t) ROUTE_BATCH_SIZE, size - first);
+
+		num_active = 0;
+		num_slow = 0;
+		for (i = 0; i < (int) count; i++) {
+			dst[i] = pairs->dst[first + i];
+			lane[i] = pairs->lane[first + i];
+			cur[i] = mytopology.host_node[pairs->src[first + i]];
+			dest[i] = mytopology.host_node[dst[i]];
+			len[i] = 0;
+			if (cur[i] != dest[i]) active[num_active++] = i;
+		}
+
+		while (num_active > 0) {
+			/* issue the loads of the whole block ... */
+			for (k = 0; k < num_active; k++) {
+				long offset = mytopology.fwd_offset[cur[active[k]]];
+				if (offset >= 0)
+					__builtin_prefetch(&mytopology.fwd_table[offset + dst[active[k]]]);
+			}
+
+			/* ... and take one hop with every pair */
+			int still_active = 0;
+			for (k = 0; k < num_active; k++) {
+				i = active[k];
+				edgeid_t edgeid = get_next_hop(&mytopology, cur[i], dst[i]);
+
+				if ((edgeid < 0) || (len[i] == ROUTE_BATCH_MAX_HOPS)) {
+					slow[num_slow++] = i;
+					continue;
+				}
+				path[i][len[i]++] = edgeid;
+				cur[i] = mytopology.edge_head[edgeid];
+				if (cur[i] == dest[i]) {
+					for (int h = 0; h < len[i]; h++)
+						full |= add_load<T, shared>(load, (size_t) path[i][h] * lanes + lane[i], touched);
+					continue;
+				}
+				__builtin_prefetch(&mytopology.fwd_offset[cur[i]]);
+				active[still_active++] = i;
+			}
+			num_active = still_active;
+		}
+
+		/* Broken routes go through find_route in pair order, so that their
+		 * messages keep the order of the pattern. The routes are recorded
+		 * in pair order as well. */
+		std::sort(slow, slow + num_slow);
+		for (i = 0, k = 0; i < (int) count; i++) {
+			if ((k < num_slow) && (slow[k] == i)) {
+				uroute_t route;
+
+				find_route(&route, pairs->src[first + i], dst[i]);
+				for (uroute_t::iterator iter = route.begin(); iter != route.end(); ++iter)
+					full |= add_load<T, shared>(load, (size_t) *iter * lanes + lane[i], touched);
+				if (arena != NULL)
+					arena->edges.insert(arena->edges.end(), route.begin(), route.end());
+				k++;
+			} else if (arena != NULL) {
+				arena->edges.insert(arena->edges.end(), path[i], path[i] + len[i]);
+			}
+			if (arena != NULL)
+				arena->offset.push_back(arena->edges.size());
+		}
+	}
+	return first;
+}
+
+void get_lane_pairs(IN std::vector<ptrn_t> *ptrns, IN std::vector<namelist_t> *namelists,
+                    OUT lane_pairs_t *pairs) {
+	size_t p, longest = 0;
+	int l;
+
+	pairs->lanes = namelists->size();
+	pairs->src.clear();
+	pairs->dst.clear();
+	pairs->lane.clear();
+	for (l = 0; l < pairs->lanes; l++)
+		longest = std::max(longest, (*ptrns)[l].size());
+
+	/* pair p of all lanes, then pair p+1 */
+	for (p = 0; p < longest; p++) {
+		for (l = 0; l < pairs->lanes; l++) {
+			ptrn_t *ptrn = &(*ptrns)[l];
+			namelist_t *namelist = &(*namelists)[l];
+
+			if (p >= ptrn->size())
+				continue;
+			pairs->src.push_back(namelist->at((*ptrn)[p].first));
+			pairs->dst.push_back(namelist->at((*ptrn)[p].second));
+			pairs->lane.push_back(l);
+		}
+	}
+}
+
+/* A level that is split among several threads: every thread routes a
+ * contiguous range of the pairs into the shared counters and records the
+ * routes and the counters it touched first on its own */
+typedef struct {
+	lane_pairs_t *pairs;
+	uint32_t *load;
+	int shards;
+	bool record;
+	std::vector<std::vector<size_t> > touched;
+	std::vector<route_arena_t> arenas;
+} level_split_t;
+
+static void route_level_shard(void *arg, int shard) {
+	level_split_t *split = (level_split_t *) arg;
+	size_t size = split->pairs->src.size();
+	size_t first = size * shard / split->shards, last = size * (shard + 1) / split->shards;
+	route_arena_t *arena = split->record ? &split->arenas[shard] : NULL;
+
+	split->touched[shard].clear();
+	if (arena != NULL) {
+		arena->edges.clear();
+		arena->offset.assign(1, 0);
+	}
+	add_lane_blocks<uint32_t, true>(split->pairs, first, last, split->load, &split->touched[shard], arena);
+}
+
+static void add_lane_loads_split(IN lane_pairs_t *pairs, OUT cable_cong_map_t *cable_cong, OUT route_arena_t *arena,
+                                 int shards) {
+	static thread_local level_split_t split;
+	int s;
+
+	cable_cong_clear(cable_cong, 4, pairs->lanes);
+	split.pairs = pairs;
+	split.load = cable_cong_counters<uint32_t>(cable_cong);
+	split.shards = shards;
+	split.record = (arena != NULL);
+	split.touched.resize(shards);
+	split.arenas.resize(shards);
+	run_parallel(shards, route_level_shard, &split);
+
+	/* the routes of the ranges one after the other keep the pair order */
+	for (s = 0; s < shards; s++) {
+		cable_cong->touched.insert(cable_cong->touched.end(), split.touched[s].begin(), split.touched[s].end());
+		if (arena == NULL)
+			continue;
+
+		route_arena_t *part = &split.arenas[s];
+		unsigned int base = arena->edges.size();
+		arena->edges.insert(arena->edges.end(), part->edges.begin(), part->edges.end());
+		for (size_t i = 1; i < part->offset.size(); i++)
+			arena->offset.push_back(base + part->offset[i]);
+	}
+}
+
+void add_lane_loads(IN lane_pairs_t *pairs, OUT cable_cong_map_t *cable_cong, OUT route_arena_t *arena) {
+	std::vector<size_t> lane_size(pairs->lanes, 0);
+	size_t first = 0, largest = 0;
+	int shards = get_level_shards(pairs->src.size());
+
+	if (arena != NULL) {
+		arena->edges.clear();
+		arena->offset.assign(1, 0);
+	}
+
+	/* Large levels are routed by several threads with shared 32 bit
+	 * counters, the width of the counters matters less than the threads */
+	if (shards > 1) {
+		add_lane_loads_split(pairs, cable_cong, arena, shards);
+		return;
+	}
+
+	/* No load can exceed the number of pairs of a lane, so small levels get
+	 * 8 bit counters that can not saturate. Larger ones start out
+	 * optimistically with 16 bits, the loads of real patterns are far below
+	 * the number of pairs. */
+	for (size_t i = 0; i < pairs->lane.size(); i++)
+		largest = std::max(largest, ++lane_size[pairs->lane[i]]);
+	cable_cong_clear(cable_cong, (largest <= 0xff) ? 1 : 2, pairs->lanes);
+	while (true) {
+		switch (cable_cong->width) {
+		case 1:
+			first = add_lane_blocks<uint8_t, false>(pairs, first, pairs->src.size(), cable_cong_counters<uint8_t>(cable_cong),
+			                        &cable_cong->touched, arena);
+			break;
+		case 2:
+			first = add_lane_blocks<uint16_t, false>(pairs, first, pairs->src.size(), cable_cong_counters<uint16_t>(cable_cong),
+			                        &cable_cong->touched, arena);
+			break;
+		default:
+			first = add_lane_blocks<uint32_t, false>(pairs, first, pairs->src.size(), cable_cong_counters<uint32_t>(cable_cong),
+			                        &cable_cong->touched, arena);
+			break;
+		}
+		if (first >= pairs->src.size())
+			break;
+		cable_cong_widen(cable_cong);
+	}
+}
+
+void add_pattern_loads(IN ptrn_t *ptrn, IN namelist_t *namelist, OUT cable_cong_map_t *cable_cong,
+                       OUT route_arena_t *arena) {
+	static thread_local lane_pairs_t pairs;
+
+	/* a single lane, the pairs stay in pattern order */
+	pairs.lanes = 1;
+	pairs.src.resize(ptrn->size());
+	pairs.dst.resize(ptrn->size());
+	pairs.lane.assign(ptrn->size(), 0);
+	for (size_t i = 0; i < ptrn->size(); i++) {
+		pairs.src[i] = namelist->at((*ptrn)[i].first);
+		pairs.dst[i] = namelist->at((*ptrn)[i].second);
+	}
+	add_lane_loads(&pairs, cable_cong, arena);
+}
@@ -0,0 +1,132 @@
+#ifndef ROUTING_HPP
+#define ROUTING_HPP
+
+#include <vector>
+#include <map>
+#include <stdio.h>
+#include "simulator.hpp"
+
+/* The route cache remembers the routes find_route computed, keyed by the
+ * (source host id, destination host id) pair. It is an open addressing hash
+ * table whose entries point into one flat arena of edge ids, so cached routes
+ * do not cost a heap allocation each. Once the memory budget is used up, no
+ * new routes are inserted; routes that are already cached stay valid.
+ *
+ * Every thread has a cache of its own, so lookups and inserts need no lock.
+ * The budget of the process is split evenly among the threads that may route
+ * at the same time (see route_cache_set_threads), and the table of a thread
+ * is only allocated when it caches its first route. The cache is only used
+ * without route trees, find_route reads the routes from the trees otherwise. */
+typedef struct {
+	std::vector<unsigned long long> keys;   /* (src << 32 | dst), ROUTE_CACHE_EMPTY if unused */
+	std::vector<size_t> offsets;            /* slot -> first edge of the route in the arena */
+	std::vector<unsigned char> lengths;     /* slot -> number of edges of the route */
+	std::vector<edgeid_t> arena;
+	int shift;                              /* 64 - log2(number of slots) */
+	size_t entries;
+	size_t budget;                          /* in bytes, 0 disables the cache */
+} route_cache_t;
+
+/* What the route store did for one thread. The counters are thread local
+ * and route_store_flush_stats adds them to the totals of the process when
+ * the thread is done, so counting costs no shared writes. */
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long rejected;            /* inserts refused because the cache is full */
+	unsigned long long cached;              /* routes inserted into the cache */
+	unsigned long long tree_lookups;        /* routes read from the route trees */
+} route_store_stats_t;
+
+#define ROUTE_CACHE_EMPTY (~0ULL)
+
+/* bytes a slot of the hash table takes: key, offset and length */
+#define ROUTE_CACHE_SLOT_BYTES (sizeof(unsigned long long) + sizeof(size_t) + sizeof(unsigned char))
+
+/* Routing is destination based, so the routes of all sources towards one
+ * destination share their suffixes and form a tree. The route trees store
+ * one such tree per destination host as a parent pointer array over the
+ * switches (the out edge a switch uses towards the destination) together
+ * with the number of hops that are left from that switch. Every route of
+ * every pair can be read from the trees, for O(hosts * switches) memory.
+ *
+ * The arrays are destination major, so all entries of one destination are
+ * contiguous. Switches from which the destination can not be reached
+ * (missing entries, loops, detours over other hosts) are marked with
+ * ROUTE_TREE_BROKEN; find_route walks the forwarding tables for those pairs
+ * to report the problem as usual. */
+typedef struct {
+	int num_switches;
+	std::vector<edgeid_t> next;             /* dst * num_switches + switch id -> edge towards dst */
+	std::vector<unsigned char> hops;        /* dst * num_switches + switch id -> edges left to dst */
+} route_trees_t;
+
+#define ROUTE_TREE_BROKEN 0xff
+
+/* Result of check_routes: the number of checked pairs and problems, the
+ * longest valid route and every pair whose route is broken. node is the
+ * node without an entry for the destination (the source itself for
+ * missing routes) or a node on the loop. */
+#define ROUTE_MISSING  0
+#define ROUTE_DEAD_END 1
+#define ROUTE_LOOP     2
+
+typedef struct {
+	hostid_t src;
+	hostid_t dst;
+	int problem;
+	nodeid_t node;
+} broken_route_t;
+
+typedef struct {
+	unsigned long long pairs;
+	unsigned long long problems[3];         /* indexed by ROUTE_MISSING .. ROUTE_LOOP */
+	int longest;
+	std::vector<broken_route_t> broken;
+} route_check_t;
+
+/* prototypes */
+void init_route_store(size_t budget);
+void route_cache_init(size_t budget);
+void route_cache_set_threads(int threads);
+void route_store_flush_stats();
+bool route_cache_lookup(OUT uroute_t *route, IN hostid_t src, IN hostid_t dst);
+void route_cache_insert(IN hostid_t src, IN hostid_t dst, IN uroute_t *route);
+void build_route_trees();
+bool route_trees_lookup(OUT uroute_t *route, IN hostid_t src, IN hostid_t dst);
+void print_route_cache_stats(FILE *fd, int mynode, int allnodes);
+
+/* Complete exchange among the hosts of a namelist, evaluated per destination.
+ * Both functions handle the destinations namelist[first .. first+count-1]
+ * only, so that the destinations can be split among the ranks.
+ * all_to_all_link_loads returns the number of routes using each edge (by
+ * edge id). all_to_all_max_loads adds, for every pair, the maximum load of
+ * the inner edges of its route (all but the first and the last one) to bins. */
+void all_to_all_link_loads(IN namelist_t *namelist, IN int first, IN int count, OUT std::vector<int> *loads);
+void all_to_all_max_loads(IN namelist_t *namelist, IN int first, IN int count,
+                          IN std::vector<int> *loads, OUT std::map<int, int> *bins);
+
+/* Checks the routes from all hosts to the destinations first .. first+count-1
+ * (host ids), the destinations are split among up to threads threads.
+ * print_route_check is collective, rank 0 prints the summary and the list of
+ * broken pairs. */
+void check_routes(IN hostid_t first, IN int count, IN int threads, OUT route_check_t *check);
+void print_route_check(IN route_check_t *check, FILE *summary, FILE *list, int mynode, int allnodes);
+
+/* Clears cable_cong, routes all pairs of a pattern and adds one to the
+ * congestion of every edge of every route. The counter width is chosen
+ * here. The routes are stored in arena in pattern order unless it is NULL. */
+void add_pattern_loads(IN ptrn_t *ptrn, IN namelist_t *namelist, OUT cable_cong_map_t *cable_cong,
+                       OUT route_arena_t *arena);
+
+/* The same for the pairs of several runs at once: get_lane_pairs collects
+ * the pairs of one level of every run (one pattern and namelist per lane)
+ * and add_lane_loads adds them to the counters of their lanes. */
+void get_lane_pairs(IN std::vector<ptrn_t> *ptrns, IN std::vector<namelist_t> *namelists,
+                    OUT lane_pairs_t *pairs);
+void add_lane_loads(IN lane_pairs_t *pairs, OUT cable_cong_map_t *cable_cong, OUT route_arena_t *arena);
+
+/* globals */
+extern route_trees_t myroutetrees;
+
+#endif
@@ -18,8 +18,11 @@
 #include <queue>
 #include <map>
 #include <mpi.h>
+#include <pthread.h>
 #include "simulator.hpp"
 #include "statistics.hpp"
+#include "topology.hpp"
+#include "routing.hpp"
 #include <string.h>
 
 #include <boost/config.hpp>
@@ -36,44 +39,90 @@ void exchange_results_by_metric(char *metric_name, int mynode, int allnodes) {
 	if (strcmp(metric_name, "hist_acc_band") == 0) {exchange_results_sum_max_cong(mynode, allnodes);}
 	if (strcmp(metric_name, "hist_max_cong") == 0) {exchange_results_hist_max_cong(mynode, allnodes);}
 	if (strcmp(metric_name, "dep_max_delay") == 0) {exchange_results_sum_max_cong(mynode, allnodes);}
+	if (strcmp(metric_name, "get_cable_cong") == 0) {exchange_results_get_cable_cong(mynode, allnodes);}
 }
 
+/* Collects the results of all processes on process 0. The processes
+ * simulate different numbers of runs (see run_queue_t), so the results
+ * are gathered with their run indices and put back into run order. */
 void exchange_results_sum_max_cong(int mynode, int allnodes) {
-	//TODO inline...
-	exchange_results2(mynode, allnodes);
+	gather_results(mynode, allnodes);
 }
 
 void exchange_results_hist_max_cong(int mynode, int allnodes) {
-	
-	int size;
-	int *bucket;
-	MPI_Status status;
-	
-	if (mynode != 0) {
-		bucket = get_bigbucket(&size);
-		MPI_Send(&size, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-		MPI_Send(bucket, size, MPI_INT, 0, 0, MPI_COMM_WORLD);
-		free(bucket);
-	}
+	reduce_bigbucket(mynode);
+}
 
-	if (mynode == 0) {
-		for (int counter = 1; counter < allnodes; counter++) {
-			MPI_Recv(&size, 1, MPI_INT, counter, 0, MPI_COMM_WORLD, &status); //size
-			bucket = (int *) malloc(size * sizeof(*bucket));
-			MPI_Recv(bucket, size, MPI_INT, counter, 0, MPI_COMM_WORLD, &status); //data
-			add_to_bigbucket(bucket, size);
-			free(bucket);
-		}
-	}
+/* The accumulated and the highest congestion of every link and the
+ * per-tier histograms are reduced, the summary is rebuilt from them */
+void exchange_results_get_cable_cong(int mynode, int allnodes) {
+	reduce_cable_cong(mynode);
 }
 
-void simulation_with_metric(char *metric_name, ptrn_t *ptrn, namelist_t *namelist, int state) {
-	if (strcmp(metric_name, "sum_max_cong") == 0) {simulation_sum_max_cong(ptrn, namelist, state);}
-	if (strcmp(metric_name, "hist_max_cong") == 0) {simulation_hist_max_cong(ptrn, namelist, state);}
-	if (strcmp(metric_name, "hist_acc_band") == 0) {simulation_hist_effective_bandwidth(ptrn, namelist, state);}
+/* Collects the hot links of all processes on process 0, k is the number
+ * of links kept per level */
+void exchange_hot_links(int mynode, int allnodes, int k) {
+	std::vector<int> local, all;
+
+	/* the links of process 0 are already in place */
+	if (mynode != 0)
+		get_hot_links(&local);
+	gather_list(&local, MPI_INT, &all, mynode, allnodes);
+	if ((mynode == 0) && !all.empty())
+		insert_hot_links(all.data(), all.size(), k);
+}
+
+void simulation_with_metric(char *metric_name, ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc) {
+	if (strcmp(metric_name, "sum_max_cong") == 0) {simulation_sum_max_cong(ptrn, namelist, state, acc);}
+	if (strcmp(metric_name, "hist_max_cong") == 0) {simulation_hist_max_cong(ptrn, namelist, state, acc);}
+	if (strcmp(metric_name, "hist_acc_band") == 0) {simulation_hist_effective_bandwidth(ptrn, namelist, state, acc);}
 	if (strcmp(metric_name, "get_cable_cong") == 0) {simulation_get_cable_cong(ptrn, namelist, state);}
 }
 
+/* Evaluates one level of several runs at once, ptrns and namelists hold
+ * the pattern and the namelist of every run (lane) of the batch. The
+ * results are the same as those of simulation_with_metric called for the
+ * runs one after the other. The per-run state lives in the lanes of acc,
+ * which stats_acc_begin_runs has to set up for the batch. Only the metrics
+ * that look at the maximum congestion of the pairs of a level are
+ * supported. */
+void simulation_multirun_with_metric(char *metric_name, std::vector<ptrn_t> *ptrns,
+                                     std::vector<namelist_t> *namelists, int state, stats_acc_t *acc) {
+	static thread_local cable_cong_map_t cable_cong;
+	static thread_local route_arena_t arena;
+	static thread_local lane_pairs_t pairs;
+	static thread_local std::vector<bucket_t> buckets;  /* lane -> weights of the level */
+	int lanes = namelists->size();
+	int lane;
+
+	if (state == RUN) {
+		bucket_t *level_buckets = &acc->run_bucket[0];
+
+		/* hist_acc_band accumulates the levels of a run in its bucket, the
+		 * others only look at the level */
+		if (strcmp(metric_name, "hist_acc_band") != 0) {
+			buckets.assign(lanes, bucket_t());
+			level_buckets = &buckets[0];
+		}
+
+		get_lane_pairs(ptrns, namelists, &pairs);
+		add_lane_loads(&pairs, &cable_cong, &arena);
+		insert_into_lane_buckets_maxcon2(&cable_cong, &arena, &pairs, level_buckets, acc);
+
+		if (strcmp(metric_name, "sum_max_cong") == 0) {
+			for (lane = 0; lane < lanes; lane++) {
+				acc->run_sum[lane] += get_bucket_max(&buckets[lane]);
+			}
+		}
+	}
+	else if (state == ACCOUNT) {
+		for (lane = 0; lane < lanes; lane++) {
+			if (strcmp(metric_name, "hist_acc_band") == 0) account_stats(acc, lane, &acc->run_bucket[lane]);
+			if (strcmp(metric_name, "sum_max_cong") == 0) account_stats_max_congestions(acc, lane, acc->run_sum[lane]);
+		}
+	}
+}
+
 void merge_two_patterns_into_one(ptrn_t *ptrn1, ptrn_t *ptrn2, int comm1_size, ptrn_t *ptrn_res) {
 
 	ptrn_res->clear();
@@ -138,7 +187,8 @@ public:
 
 /* TODO: this function signature is ugly and could be built with the old
  * scheme and global variables and side effects */
-void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int valid_until, int myrank) {
+void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int valid_until, int myrank,
+                              stats_acc_t *acc) {
 	// Vertex properties - name
 	typedef property < vertex_name_t, std::string, property < vertex_info_t, vertex_t, property < vertex_dist_t, int > > > vertex_p;
 	// Edge properties - routing table as comment
@@ -172,12 +222,9 @@ void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int vali
 
 
 		// first step - fill cable congestion map
-		cable_cong_map_t cable_cong;
-		for (ptrn_t::iterator iter_ptrn = ptrn.begin(); iter_ptrn != ptrn.end(); ++iter_ptrn) {
-			uroute_t route;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			insert_route_into_cable_cong_map(&cable_cong, &route);
-		}
+		static thread_local cable_cong_map_t cable_cong;
+		static thread_local route_arena_t arena;
+		add_pattern_loads(&ptrn, namelist, &cable_cong, &arena);
 
 		// step two: build graph with weighted edges
 		//  vertices are tuples of (level, rank)
@@ -193,10 +240,12 @@ void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int vali
 			//printf("%i %i\n", iter_ptrn->first, valid_until);
 			if((iter_ptrn->first >= valid_until) || (iter_ptrn->second >= valid_until)) continue;
 
-			uroute_t route;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			int weight;
-			get_max_congestion(&route, &cable_cong, &weight);
+			/* the route was recorded in the first step */
+			size_t pair = iter_ptrn - ptrn.begin();
+			int weight = 0;
+			for (unsigned int i = arena.offset[pair]; i < arena.offset[pair + 1]; i++) {
+				if (weight < (int) cable_cong_get(&cable_cong, arena.edges[i])) weight = cable_cong_get(&cable_cong, arena.edges[i]);
+			}
 
 			vertex_t source_vertex_prop, dest_vertex_prop;
 			source_vertex_prop.name = iter_ptrn->first;
@@ -289,103 +338,71 @@ void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int vali
 		}
 		// TODO: put into bin
 		//printf("[%i] max: %i\n", myrank, max);
-		account_stats_max_congestions(max);
+		account_stats_max_congestions(acc, 0, max);
 	}
 }
 
-void simulation_hist_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state) {
-	cable_cong_map_t cable_cong;
-	ptrn_t::iterator iter_ptrn;
+void simulation_hist_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc) {
+	static thread_local cable_cong_map_t cable_cong;
+	static thread_local route_arena_t arena;
 	bucket_t bucket;
 
 	if (state == RUN) {
-		int i = 0;
-		for (iter_ptrn = ptrn->begin(); iter_ptrn != ptrn->end(); ++iter_ptrn) {
-			uroute_t route;
-			i++;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			insert_route_into_cable_cong_map(&cable_cong, &route);
-#ifdef TDEBUG
-			if (i % 100 == 1) {printf("[%d/%zu]\n", i, ptrn->size());}
-#endif
-		}
+		add_pattern_loads(ptrn, namelist, &cable_cong, &arena);
 
-		bucket.clear();
-		insert_into_bucket_maxcon2(&cable_cong, ptrn, namelist, &bucket);
+		insert_into_bucket_maxcon2(&cable_cong, &arena, &bucket, acc);
+		if (acc->hot_links > 0) record_hot_links(&cable_cong, &arena, ptrn, namelist, acc);
 	}
 }
 
 void simulation_get_cable_cong(ptrn_t *ptrn, namelist_t *namelist, int state) {
-	cable_cong_map_t cable_cong;
-	ptrn_t::iterator iter_ptrn;
+	static thread_local cable_cong_map_t cable_cong;
+	static thread_local route_arena_t arena;
 
 	if (state == RUN) {
-		int i = 0;
-		for (iter_ptrn = ptrn->begin(); iter_ptrn != ptrn->end(); ++iter_ptrn) {
-			uroute_t route;
-			i++;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			insert_route_into_cable_cong_map(&cable_cong, &route);
-			apply_cable_cong_map_to_global_cable_cong_map(&cable_cong);
-		}
+		add_pattern_loads(ptrn, namelist, &cable_cong, &arena);
+		apply_cable_cong_map_to_global_cable_cong_map(&cable_cong, &arena);
 	}
 }
 
 
-void simulation_hist_effective_bandwidth(ptrn_t *ptrn, namelist_t *namelist, int state) {
-	used_edges_t edge_list;
-	cable_cong_map_t cable_cong;
-	ptrn_t::iterator iter_ptrn;
-	static bucket_t bucket;
+void simulation_hist_effective_bandwidth(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc) {
+	static thread_local cable_cong_map_t cable_cong;
+	static thread_local route_arena_t arena;
 
+	/* the bucket of the run is kept in the accumulator */
 	if (state == RUN) {
-		for (iter_ptrn = ptrn->begin(); iter_ptrn != ptrn->end(); ++iter_ptrn) {
-			uroute_t route;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			insert_route_into_cable_cong_map(&cable_cong, &route);
-		}
+		add_pattern_loads(ptrn, namelist, &cable_cong, &arena);
 
-		std::sort(edge_list.begin(), edge_list.end());
-		insert_into_bucket_maxcon2(&cable_cong, ptrn, namelist, &bucket);
+		insert_into_bucket_maxcon2(&cable_cong, &arena, &acc->run_bucket[0], acc);
+		if (acc->hot_links > 0) record_hot_links(&cable_cong, &arena, ptrn, namelist, acc);
 
 		//		account_stats(&bucket);
 		//		bucket.clear();
 
 	}
 	else if (state == ACCOUNT) {
-		account_stats(&bucket);
-		bucket.clear();
+		account_stats(acc, 0, &acc->run_bucket[0]);
+		acc->run_bucket[0].clear();
 	}
 }
 
-void simulation_sum_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state) {
-	used_edges_t edge_list;
-	cable_cong_map_t cable_cong;
-	ptrn_t::iterator iter_ptrn;
+void simulation_sum_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc) {
+	static thread_local cable_cong_map_t cable_cong;
+	static thread_local route_arena_t arena;
 	bucket_t bucket;
-	static int sum_max_congestions = 0;
 
 	if (state == RUN) {
-		for (iter_ptrn = ptrn->begin(); iter_ptrn != ptrn->end(); ++iter_ptrn) {
-			uroute_t route;
-			find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
-			insert_route_into_cable_cong_map(&cable_cong, &route);
-		}
+		add_pattern_loads(ptrn, namelist, &cable_cong, &arena);
 
-		std::sort(edge_list.begin(), edge_list.end());
-		bucket.clear();
-		insert_into_bucket_maxcon2(&cable_cong, ptrn, namelist, &bucket);
+		insert_into_bucket_maxcon2(&cable_cong, &arena, &bucket, acc);
+		if (acc->hot_links > 0) record_hot_links(&cable_cong, &arena, ptrn, namelist, acc);
 
-		int counter;
-		int loc_max_congestion=0;
-		for (counter=0; counter<bucket.size(); counter++) {
-			if (bucket.at(counter) > 0) {loc_max_congestion = counter;}
-		}
-		sum_max_congestions += loc_max_congestion;
+		acc->run_sum[0] += get_bucket_max(&bucket);
 	}
 	else if (state == ACCOUNT) {
-		account_stats_max_congestions(sum_max_congestions);
-		sum_max_congestions = 0;
+		account_stats_max_congestions(acc, 0, acc->run_sum[0]);
+		acc->run_sum[0] = 0;
 	}
 }
 
@@ -394,90 +411,72 @@ void print_namelist(namelist_t *namelist, const char *header) {
 	if(namelist->size() == 0) printf(" namelist empty! ============\n");
 	else {
 		for (int i=0; i<namelist->size()-1; i++) {
-			std::cout << "\n" << namelist->at(i);
+			std::cout << "\n" << get_host_name(namelist->at(i));
 		}
-		std::cout << "\n" <<namelist->at(namelist->size()-1) << "\n===============\n\n";
+		std::cout << "\n" << get_host_name(namelist->at(namelist->size()-1)) << "\n===============\n\n";
 	}
 }
 
-void find_route(uroute_t *route, std::string n1, std::string n2) {
+/* Loop detection for find_route: a node was visited on the current route
+ * if its stamp equals the current epoch, so nothing has to be cleared or
+ * allocated per route */
+static thread_local std::vector<unsigned int> route_visited;
+static thread_local unsigned int route_epoch = 0;
+
+void find_route(uroute_t *route, hostid_t src, hostid_t dst) {
 
 	/**
  * This function returns the list of edges used for the communication from the
- * node named n1 to the node named n2 in a vector of edges.
+ * host src to the host dst in a vector of edges. The next hops are taken from
+ * the forwarding tables built by compile_forwarding_tables.
  * */
 
-	Agedge_t *e;
-	Agnode_t *start;
-	Agnode_t *dest;
+	nodeid_t start, dest;
 	edgeid_t edgeid;
-	std::map<std::string, int> theMap;
-	std::pair<std::map<std::string, int>::iterator, bool> theMap_returnval;
-
-	start = agnode(mygraph, (char *) n1.c_str(), 0);
-	dest = agnode(mygraph, (char *) n2.c_str(), 0);
 
-	if ((start == NULL) || (dest == NULL)) {
-		printf("I didn't find one of the hosts %s and %s!\n", n1.c_str(), n2.c_str());
+	if (route_trees_lookup(route, src, dst))
+		return;
+	if (route_cache_lookup(route, src, dst))
 		return;
-	}
-	while (start != dest) {
-		//printf("Start: %s Dest:  %s\n", agnameof(start), agnameof(dest));
-		for (e = agfstout(mygraph, start); e; e = agnxtout(mygraph, e)) {
-			//printf("considering edge %s with comment %s\n", agnameof(e), agget(e, ((char *) "comment")));
-			if (contains_target(agget(e, ((char *) "comment")), (char *) n2.c_str())) {
-				//printf("Using edge: %s\n", agnameof(e));
-				theMap_returnval = theMap.insert( std::make_pair(agnameof(aghead(e)), 1));
-				if (theMap_returnval.second == false) {
-					printf("I tried to visit a node I already visited on the same route. This means we have a routing loop!\n");
-					FILE *fderr = fopen("routing_loops.txt", "a");
-					if (fderr == NULL) { printf("Eeeek!\n"); exit(EXIT_FAILURE); }
-					fprintf(fderr, "%s -> %s\n", agnameof(start), agnameof(dest));
-					fclose(fderr);
-					route->erase( route->begin(), route->end());
-					return;
-				}
-				//edgeid.assign(agget(e, ((char *) "edge_id")));
-				edgeid = atoi(agget(e, ((char *) "edge_id")));
-				route->push_back(edgeid);
-				start = aghead(e);
-				break;
-			}
-		}
-		if (e == NULL) {
-			printf("There seems to be no route from %s to %s.\n", (char *) n1.c_str(), (char *) n2.c_str());
-			break;
-		}
-	}
-}
-
-int contains_target(char *comment, char *target) {
 
-	/**
-	 * This function checks if our target appears in the commma seperated list of
-	 * targets, encoded as a comment in the dot file. Returns 1 if yes, 0
-	 * otherwise. A single star '*' in the comment matches any target.
-	 * */
+	start = mytopology.host_node[src];
+	dest = mytopology.host_node[dst];
 
-	//	printf("Comment: %s\n", commentin);
-	//	printf("Target: %s\n", target);
+	/* a new epoch marks all nodes as not visited */
+	if (route_visited.size() != get_num_nodes())
+		route_visited.assign(get_num_nodes(), 0);
+	if (++route_epoch == 0) {
+		std::fill(route_visited.begin(), route_visited.end(), 0);
+		route_epoch = 1;
+	}
 
-	char *buffer;
-	char *result;
+	while (start != dest) {
+		edgeid = get_next_hop(&mytopology, start, dst);
+		if (edgeid < 0) {
+			printf("There seems to be no route from %s to %s.\n", get_host_name(src), get_host_name(dst));
+			return;
+		}
 
-	if (strcmp(comment, "*") == 0) return 1;
-	buffer = (char *) malloc(strlen(comment) * sizeof(*buffer) + 1);
-	strcpy(buffer, comment);
-	result = strtok(buffer, ", \t\n");
-	
-	while ((result != NULL) and (strcmp(result, target) != 0)) {
-		result = strtok(NULL, ", \t\n");
-		if (result == NULL) break;
+		/* A route must not visit the same node twice. The heads of the edges
+		 * we already took are exactly the nodes we visited (except for the
+		 * very first one). */
+		nodeid_t head = mytopology.edge_head[edgeid];
+		if (route_visited[head] == route_epoch) {
+			printf("I tried to visit a node I already visited on the same route. This means we have a routing loop!\n");
+			FILE *fderr = fopen("routing_loops.txt", "a");
+			if (fderr == NULL) { printf("Eeeek!\n"); exit(EXIT_FAILURE); }
+			fprintf(fderr, "%s -> %s\n", get_node_name(start), get_node_name(dest));
+			fclose(fderr);
+			route->clear();
+			return;
+		}
+		route_visited[head] = route_epoch;
+		route->push_back(edgeid);
+		start = head;
 	}
-	free(buffer);
 
-	if (result == NULL) return 0;
-	else return 1;
+	/* Broken routes are not cached, so that they are reported every time */
+	route_cache_insert(src, dst, route);
 }
 
 unsigned long long convert_nodename_to_guid(std::string nodename) {
@@ -503,7 +502,7 @@ void get_guidlist_from_namelist(IN namelist_t *namelist,
 	guidlist->clear();
 
 	for (i = 0; i < namelist->size(); i++)
-		guidlist->push_back(convert_nodename_to_guid(namelist->at(i)));
+		guidlist->push_back(convert_nodename_to_guid(get_host_name(namelist->at(i))));
 }
 
 void get_namelist_from_guidlist(IN guidlist_t *guidlist,
@@ -549,23 +548,16 @@ void get_namelist_from_graph(namelist_t *namelist) {
 void get_namelist_from_graph(OUT namelist_t *namelist,
                              OUT guidlist_t *guidlist) {
 	
-	/** This function places an array of strings (the node names) at the given
-	 * position and returns the number of elements in that array. This list should
-	 * be generated once and can be used for mapping the node names to integers. The
-	 * list is NOT random.
+	/** This function places the list of all hosts at the given position. This
+	 * list should be generated once and can be used for mapping the node names
+	 * to integers. The list is NOT random, hosts appear in the same order as in
+	 * the dot file.
 	 **/
 	
-	Agnode_t *node;
-	std::string nodename;
-
-	node = agfstnode(mygraph);
-	while (node != NULL) {
-		nodename = (std::string) agnameof(node);
-		if (nodename.find('H', 0) == 0) {
-			namelist->push_back(nodename);
-		}
-		node = agnxtnode(mygraph, node);
-	}
+	hostid_t host;
+
+	for (host = 0; host < mytopology.host_node.size(); host++)
+		namelist->push_back(host);
 
 	/* If a guidlist has been provided (not NULL), then get a list
 	 * of numeric GUIDs as well */
@@ -612,32 +604,30 @@ void generate_random_namelist(OUT namelist_t *namelist,
 void generate_linear_namelist_bfs(OUT namelist_t *namelist,
                                   IN int comm_size) {
 
-	Agnode_t *node;
-	std::queue<Agnode_t*> queue;
-	// HTOR: didn't you say that one is not supposed to use the pointer
-	// to the char returned by libagraph?
-	std::map<char*, int> color;
-	Agedge_t *e;
+	nodeid_t node;
+	std::queue<nodeid_t> queue;
+	std::vector<bool> color(get_num_nodes(), false);
+	edgeid_t e;
 	
 	namelist->clear();
 
-	node = agfstnode(mygraph);
+	node = 0;
 	queue.push(node);
-	color[agnameof(node)] = 1;
+	color[node] = true;
 	while (!queue.empty()) {
 		node = queue.front();
 		queue.pop();
-		std::string nodename = (std::string) agnameof(node);
-		if (nodename.find('H', 0) == 0) {
+		hostid_t host = mytopology.host_index[node];
+		if (host >= 0) {
 			if (namelist->size() < comm_size) {
-				namelist->push_back(nodename);
+				namelist->push_back(host);
 			}
 		}
-		//mark_and_insert(node);
-		for (e = agfstout(mygraph, node); e; e = agnxtout(mygraph, e)) {
-			if (color[agnameof(aghead(e))] == 0) {
-				queue.push(aghead(e));
-				color[agnameof(aghead(e))] = 1;
+		for (e = mytopology.out_offset[node]; e < mytopology.out_offset[node + 1]; e++) {
+			nodeid_t head = mytopology.edge_head[e];
+			if (!color[head]) {
+				queue.push(head);
+				color[head] = true;
 			}
 		}
 	}
@@ -697,15 +687,22 @@ void generate_linear_namelist_guid_order(OUT namelist_t *namelist,
 	}
 }
 
-void shuffle_namelist(namelist_t *namelist) {
+/* Shuffles the namelist with the given generator, or with a freshly
+ * seeded one if mtrand is NULL */
+void shuffle_namelist(namelist_t *namelist, MTRand *mtrand) {
 	
 	std::vector<bool> bucket(namelist->size(), false);
 	namelist_t shuffled_list;
-	MTRand mtrand;
 	int counter;
 
+	/* seeding a generator reads /dev/urandom, only do it if we need one */
+	if (mtrand == NULL) {
+		MTRand own_mtrand;
+		shuffle_namelist(namelist, &own_mtrand);
+		return;
+	}
 	for (counter = 1; counter <= namelist->size(); counter++) {
-		int myrand = mtrand.randInt(namelist->size() - counter);
+		int myrand = mtrand->randInt(namelist->size() - counter);
 		int pos=0;
 		while (true) {
 			if (bucket[pos] == false) {
@@ -722,46 +719,123 @@ void shuffle_namelist(namelist_t *namelist) {
 	namelist->swap(shuffled_list);
 }
 
-void insert_route_into_cable_cong_map(cable_cong_map_t *cable_cong, uroute_t *route) {
+template <typename T>
+static void clear_counters(std::vector<T> *load, std::vector<size_t> *touched) {
+	for (std::vector<size_t>::iterator iter = touched->begin(); iter != touched->end(); ++iter)
+		(*load)[*iter] = 0;
+}
 
-	uroute_t::iterator iter_route;
-	for (iter_route = route->begin(); iter_route != route->end(); ++iter_route) {
-		std::pair<cable_cong_map_t::iterator, bool> ret;
+template <typename T>
+static void size_counters(std::vector<T> *load, size_t size) {
+	if (load->size() != size)
+		load->assign(size, 0);
+}
+
+void cable_cong_clear(cable_cong_map_t *cable_cong, int width, int lanes) {
+	size_t size = (size_t) get_num_edges() * lanes;
+
+	/* zero what the last level used, then switch to the new width */
+	switch (cable_cong->width) {
+	case 1: clear_counters(&cable_cong->load8, &cable_cong->touched); break;
+	case 2: clear_counters(&cable_cong->load16, &cable_cong->touched); break;
+	case 4: clear_counters(&cable_cong->load32, &cable_cong->touched); break;
+	}
+	cable_cong->touched.clear();
+
+	cable_cong->width = width;
+	cable_cong->lanes = lanes;
+	switch (width) {
+	case 1: size_counters(&cable_cong->load8, size); break;
+	case 2: size_counters(&cable_cong->load16, size); break;
+	default: size_counters(&cable_cong->load32, size); break;
+	}
+}
+
+void cable_cong_widen(cable_cong_map_t *cable_cong) {
+	std::vector<size_t>::iterator iter;
 
-		ret = cable_cong->insert(std::make_pair(*iter_route, 1));
-		if (ret.second == false) {
-			ret.first->second = ret.first->second + 1;
+	/* move the touched counters to the next width */
+	if (cable_cong->width == 1) {
+		size_counters(&cable_cong->load16, cable_cong->load8.size());
+		for (iter = cable_cong->touched.begin(); iter != cable_cong->touched.end(); ++iter) {
+			cable_cong->load16[*iter] = cable_cong->load8[*iter];
+			cable_cong->load8[*iter] = 0;
 		}
+		cable_cong->width = 2;
+	} else if (cable_cong->width == 2) {
+		size_counters(&cable_cong->load32, cable_cong->load16.size());
+		for (iter = cable_cong->touched.begin(); iter != cable_cong->touched.end(); ++iter) {
+			cable_cong->load32[*iter] = cable_cong->load16[*iter];
+			cable_cong->load16[*iter] = 0;
+		}
+		cable_cong->width = 4;
 	}
 }
 
-void get_max_congestion(uroute_t *route, cable_cong_map_t *cable_cong, int *weight) {
+int level_threads = 1;
+int mpi_thread_support = MPI_THREAD_SINGLE;
 
-	uroute_t::iterator route_iter;
-	*weight = 0;
-	int loc_weight = 0;
+/* The number of threads a level of the given size is split among */
+int get_level_shards(size_t pairs) {
+	return (int) std::max((size_t) 1, std::min((size_t) level_threads, pairs / LEVEL_SPLIT_PAIRS));
+}
 
-	/* go over the physical edges of the route */
-	for (route_iter = route->begin(); route_iter != route->end(); ++route_iter) {
+typedef struct {
+	void (*fn)(void *arg, int index);
+	void *arg;
+	int index;
+	pthread_t thread;
+} parallel_task_t;
+
+static void *run_parallel_task(void *arg) {
+	parallel_task_t *task = (parallel_task_t *) arg;
+
+	task->fn(task->arg, task->index);
+	route_store_flush_stats();
+	return NULL;
+}
 
-		cable_cong_map_t::iterator it;
-		it = cable_cong->find(*route_iter);
-		if (it == cable_cong->end()) {
-			printf("There has been a serious error: Route contained entry not in cable_cong\n");
-			exit(EXIT_FAILURE);
-		}
-		if (loc_weight < it->second) {
-			loc_weight = it->second;
-		}
+/* Calls fn(arg, i) for i = 0 .. threads-1 in parallel and waits for all of
+ * them, fn(arg, 0) runs in the calling thread. If a thread can not be
+ * started, its part runs in the calling thread as well. */
+void run_parallel(int threads, void (*fn)(void *arg, int index), void *arg) {
+	std::vector<parallel_task_t> tasks(threads);
+	std::vector<bool> started(threads, false);
+	int i;
+
+	for (i = 1; i < threads; i++) {
+		tasks[i].fn = fn;
+		tasks[i].arg = arg;
+		tasks[i].index = i;
+		started[i] = (pthread_create(&tasks[i].thread, NULL, run_parallel_task, &tasks[i]) == 0);
+	}
+	fn(arg, 0);
+	for (i = 1; i < threads; i++) {
+		if (started[i]) pthread_join(tasks[i].thread, NULL);
+		else fn(arg, i);
 	}
-	*weight = loc_weight;
+}
+
+void cong_queue_init(cong_queue_t *q) {
+	q->slot.clear();
+	q->bucket.clear();
+	q->bucket.resize(1);
+	q->max = 0;
+}
+
+void insert_route_into_cable_cong_map(cable_cong_map_t *cable_cong, uroute_t *route) {
+
+	uroute_t::iterator iter_route;
+	for (iter_route = route->begin(); iter_route != route->end(); ++iter_route)
+		cable_cong_add(cable_cong, *iter_route, 1);
 }
 
 void my_mpi_init(int *argc, char ***argv, int *rank, int *comm_size) {
 	int *recvbuf_id, name_len, i;
 	char processor_name[MPI_MAX_PROCESSOR_NAME], *recvbuf_proc_name;
 
-	MPI_Init(argc, argv);
+	/* the worker threads of a process take turns with MPI (see run_queue_t) */
+	MPI_Init_thread(argc, argv, MPI_THREAD_SERIALIZED, &mpi_thread_support);
 	MPI_Comm_size(MPI_COMM_WORLD, comm_size);
 	MPI_Comm_rank(MPI_COMM_WORLD, rank);
 
@@ -948,27 +1022,6 @@ exit:
 	MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
 }
 
-void tag_edges(Agraph_t *mygraph) {
-	Agnode_t *n;
-	int id_cnt;
-	char edge_id[64];
-	
-	id_cnt = 0;
-	agattr(mygraph, AGEDGE, (char *) "edge_id", (char *) "");
-	n = agfstnode(mygraph);
-	while (n != NULL) {
-		Agedge_t *e = agfstout(mygraph, n);
-		while (e != NULL) {
-			sprintf(edge_id, "%d", id_cnt);
-			id_cnt++;
-			agset(e, (char *) "edge_id", edge_id);
-			//printf("Edge-ID: %s\n", agget(e, (char *) "edge_id"));
-			e = agnxtout(mygraph, e);
-		}
-		n = agnxtnode(mygraph, n);
-	}
-}
-
 void read_node_ordering(IN char *filename,
                         OUT guidlist_t *guidorder_list) {
 
@@ -1016,34 +1069,106 @@ void read_node_ordering(IN char *filename,
 	fclose(fd);
 }
 
+/* writes a dot string, escaping the quotes within */
+static void write_dot_string(FILE *fd, const std::string &str) {
+	fputc('"', fd);
+	for (std::string::const_iterator iter = str.begin(); iter != str.end(); ++iter) {
+		if (*iter == '"') fputc('\\', fd);
+		fputc(*iter, fd);
+	}
+	fputc('"', fd);
+}
+
+/* writes name=value, separated from a preceding attribute by ", " */
+static void write_dot_attr(FILE *fd, const std::string &name, const std::string &value, bool first) {
+	if (!first) fprintf(fd, ", ");
+	write_dot_string(fd, name);
+	fprintf(fd, "=");
+	write_dot_string(fd, value);
+}
+
+/* writes the declared defaults of all attributes in attrs */
+static void write_dot_defaults(FILE *fd, dot_attrs_t *attrs, bool first) {
+	for (size_t a = 0; a < attrs->names.size(); a++, first = false)
+		write_dot_attr(fd, attrs->names[a], attrs->defaults[a], first);
+}
+
+/* writes the attribute values of object i that differ from the defaults */
+static void write_dot_values(FILE *fd, dot_attrs_t *attrs, long i, bool first) {
+	for (long v = attrs->offset[i]; v < attrs->offset[i + 1]; v++, first = false)
+		write_dot_attr(fd, attrs->names[attrs->attr[v]], attrs->value[v], first);
+}
+
 void write_graph_with_congestions() {
 
-	Agnode_t *n;
-	char cong_str[64];
-	char color_str[128];
-
-	agattr(mygraph, AGEDGE, (char *) "congestion", (char *) "");
-	agattr(mygraph, AGEDGE, (char *) "color", (char *) "");
-	n = agfstnode(mygraph);
-	while (n != NULL) {
-		Agedge_t *e = agfstout(mygraph, n);
-		while (e != NULL) {
-			char *eid = agget(e, (char *) "edge_id");
-			float cong = get_congestion_by_edgeid(atoi(eid));
-			cong /= get_max_from_global_cong_map();
-			sprintf(cong_str, "%f", cong);
-			cong = 1 - cong;
-			agset(e, (char *) "congestion", cong_str);
-			float h = cong * 0.4;
+	nodeid_t n;
+	edgeid_t e;
+	std::vector<bool> has_edges(get_num_nodes(), false);
+	int max_cong = get_max_from_global_cong_map();
+	topology_t *topo = &mytopology;
+
+	/* The graph has been closed after loading, so we write it from the
+	 * topology snapshot with all attributes of the input, and the
+	 * congestion and color attributes added */
+	for (n = 0; n < get_num_nodes(); n++) {
+		for (e = topo->out_offset[n]; e < topo->out_offset[n + 1]; e++) {
+			has_edges[n] = true;
+			has_edges[topo->edge_head[e]] = true;
+		}
+	}
+
+	fprintf(stdout, "digraph ");
+	write_dot_string(stdout, topo->graph_name);
+	fprintf(stdout, " {\n");
+	/* the graph attributes are declared with the values of the root graph */
+	if (!topo->graph_attrs.names.empty()) {
+		fprintf(stdout, "\tgraph [");
+		write_dot_defaults(stdout, &topo->graph_attrs, true);
+		write_dot_values(stdout, &topo->graph_attrs, 0, false);
+		fprintf(stdout, "];\n");
+	}
+	if (!topo->node_attrs.names.empty()) {
+		fprintf(stdout, "\tnode [");
+		write_dot_defaults(stdout, &topo->node_attrs, true);
+		fprintf(stdout, "];\n");
+	}
+	fprintf(stdout, "\tedge [comment=\"\", edge_id=\"\", congestion=\"\", color=\"\"");
+	write_dot_defaults(stdout, &topo->edge_attrs, false);
+	fprintf(stdout, "];\n");
+	for (n = 0; n < get_num_nodes(); n++) {
+		bool no_attrs = (topo->node_attrs.offset[n] == topo->node_attrs.offset[n + 1]);
+
+		if (has_edges[n] && no_attrs) continue;
+		fprintf(stdout, "\t");
+		write_dot_string(stdout, topo->node_names[n]);
+		if (!no_attrs) {
+			fprintf(stdout, " [");
+			write_dot_values(stdout, &topo->node_attrs, n, true);
+			fprintf(stdout, "]");
+		}
+		fprintf(stdout, ";\n");
+	}
+	for (n = 0; n < get_num_nodes(); n++) {
+		for (e = topo->out_offset[n]; e < topo->out_offset[n + 1]; e++) {
+			float cong = get_congestion_by_edgeid(e);
+			cong /= max_cong;
+			float h = (1 - cong) * 0.4;
 			float s = 0.9;
 			float v = 0.9;
-			sprintf(color_str, "%f %f %f", h, s, v);
-			agset(e, (char *) "color", (char *) &color_str);
-			e = agnxtout(mygraph, e);
+
+			fprintf(stdout, "\t");
+			write_dot_string(stdout, topo->node_names[n]);
+			fprintf(stdout, " -> ");
+			write_dot_string(stdout, topo->node_names[topo->edge_head[e]]);
+			fprintf(stdout, " [key=");
+			write_dot_string(stdout, topo->edge_key[e]);
+			fprintf(stdout, ", comment=");
+			write_dot_string(stdout, get_edge_comment(e));
+			write_dot_values(stdout, &topo->edge_attrs, e, false);
+			fprintf(stdout, ", edge_id=\"%d\", congestion=\"%f\", color=\"%f %f %f\"];\n", e, cong, h, s, v);
 		}
-		n = agnxtnode(mygraph, n);
 	}
-	agwrite(mygraph, stdout);
+	fprintf(stdout, "}\n");
 }
 
 void bcast_guidlist(guidlist_t *guidlist, int my_mpi_rank) {
@@ -1078,42 +1203,17 @@ void bcast_guidlist(guidlist_t *guidlist, int my_mpi_rank) {
 
 void bcast_namelist(namelist_t *namelist, int my_mpi_rank) {
 	int count = 0;
-	char *buffer;
-	
-	/* Pack buffer on rank 0 */
-	if(my_mpi_rank == 0) {
-		int i;
-
-		for (i = 0; i < namelist->size(); i++) {
-			count += strlen(namelist->at(i).c_str()) + 1;
-		}
-
-		buffer = (char *) malloc(count * sizeof(*buffer));
-		char *pos = buffer;
-		for (i = 0; i < namelist->size(); i++) {
-			strcpy(pos, namelist->at(i).c_str());
-			pos += strlen(namelist->at(i).c_str()) + 1;
-		}
-	}
 
 	/* bcast buffer size */
+	if(my_mpi_rank == 0)
+		count = namelist->size();
 	MPI_Bcast(&count, 1, MPI_INT, 0, MPI_COMM_WORLD);
 	if(my_mpi_rank != 0)
-		buffer = (char *) malloc(count * sizeof(*buffer));
-
-	/* bcast buffer data */
-	MPI_Bcast(buffer, count, MPI_CHAR, 0, MPI_COMM_WORLD);
+		namelist->resize(count);
 
-	/* unpack buffer data on clients */
-	if(my_mpi_rank != 0) {
-		char *pos = buffer;
-		while (pos < buffer + count) {
-			namelist->push_back(pos);
-			pos += namelist->back().length() + 1;
-		}
-	}
-	
-	free(buffer);
+	/* bcast host ids, they are the same on all nodes */
+	if (count > 0)
+		MPI_Bcast(&namelist->at(0), count, MPI_INT, 0, MPI_COMM_WORLD);
 }
 
 void print_namelist_from_all(IN namelist_t *namelist,
@@ -1121,63 +1221,35 @@ void print_namelist_from_all(IN namelist_t *namelist,
                              IN int commsize) {
 
 	int count = 0;
-	char *buffer, *pos;
 	int i;
 
-	/* Pack buffer on rank 0 */
+	/* a process without a run in this round passes NULL and sends -1 */
 	if(my_mpi_rank == 0) {
 		char header[100] = { 0 };
 		sprintf(header, "Namelist in node with rank 0");
-		print_namelist(namelist, header);
+		if (namelist != NULL)
+			print_namelist(namelist, header);
 
 		for (i = 1; i < commsize; i++) {
 			namelist_t tmp_namelist;
 
 			MPI_Recv(&count, 1, MPI_INT, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-			buffer = (char *) malloc(count * sizeof(*buffer));
-			if (buffer == NULL)
-				goto exit;
-
-			MPI_Recv(buffer, count, MPI_CHAR, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-			pos = buffer;
-			while (pos < buffer + count) {
-				tmp_namelist.push_back(pos);
-				pos += tmp_namelist.back().length() + 1;
-			}
+			if (count < 0)
+				continue;
+			tmp_namelist.resize(count);
+			if (count > 0)
+				MPI_Recv(&tmp_namelist.at(0), count, MPI_INT, i, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
 			sprintf(header, "Namelist in node with rank '%d'", i);
 			print_namelist(&tmp_namelist, header);
-
-			free(buffer);
 		}
 
 	} else {
-		for (i = 0; i < namelist->size(); i++)
-			count += strlen(namelist->at(i).c_str()) + 1;
-
+		count = (namelist != NULL) ? (int) namelist->size() : -1;
 		MPI_Send(&count, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-
-		buffer = (char *) malloc(count * sizeof(*buffer));
-		if (buffer == NULL)
-			goto exit;
-
-		pos = buffer;
-		for (i = 0; i < namelist->size(); i++) {
-			strcpy(pos, namelist->at(i).c_str());
-			pos += strlen(namelist->at(i).c_str()) + 1;
-		}
-
-		MPI_Send(buffer, count, MPI_CHAR, 0, 0, MPI_COMM_WORLD);
-
-		free(buffer);
+		if (count > 0)
+			MPI_Send(&namelist->at(0), count, MPI_INT, 0, 0, MPI_COMM_WORLD);
 	}
-
-	return;
-
-exit:
-	fprintf(stderr, "Node wirth rank %d could not allocate buffer in "
-	        "function print_namelist_from_all\n", my_mpi_rank);
-	MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
 }
 
 void print_commandline_options(FILE *fd, cmdargs_t *cmdargs) {
@@ -1217,7 +1289,11 @@ void print_results(cmdargs_t *cmdargs, int mynode, int allnodes) {
 			if (strcmp(cmdargs->args_info.metric_arg, "sum_max_cong") == 0) {print_statistics_max_congestions(stdout);}
 			if (strcmp(cmdargs->args_info.metric_arg, "hist_acc_band") == 0) {print_histogram(stdout);}
 			if (strcmp(cmdargs->args_info.metric_arg, "hist_max_cong") == 0) {printbigbucket(stdout);}
-			if (strcmp(cmdargs->args_info.metric_arg, "get_cable_cong") == 0) {write_graph_with_congestions();}
+			if (strcmp(cmdargs->args_info.metric_arg, "get_cable_cong") == 0) {
+				if (cmdargs->args_info.full_cable_cong_given) write_graph_with_congestions();
+				else print_cable_cong_summary(stdout);
+			}
+			if (cmdargs->args_info.hot_links_arg > 0) {print_hot_links(stdout, cmdargs->args_info.hot_links_arg);}
 		}
 		else {
 			FILE *fd;
@@ -1233,36 +1309,70 @@ void print_results(cmdargs_t *cmdargs, int mynode, int allnodes) {
 				if (strcmp(cmdargs->args_info.metric_arg, "sum_max_cong") == 0) {print_statistics_max_congestions(fd);}
 				if (strcmp(cmdargs->args_info.metric_arg, "dep_max_delay") == 0) {print_statistics_max_delay(fd);}
 				if (strcmp(cmdargs->args_info.metric_arg, "hist_max_cong") == 0) {printbigbucket(fd);}
-				if (strcmp(cmdargs->args_info.metric_arg, "get_cable_cong") == 0) {print_cable_cong(fd);}
+				if (strcmp(cmdargs->args_info.metric_arg, "get_cable_cong") == 0) {
+					if (cmdargs->args_info.full_cable_cong_given) print_cable_cong(fd);
+					else print_cable_cong_summary(fd);
+				}
+				if (cmdargs->args_info.hot_links_arg > 0) {print_hot_links(fd, cmdargs->args_info.hot_links_arg);}
 				fclose(fd);
 			}
 		}
 	}
 }
 
-void exchange_results2(int mynode, int allnodes) {
-	
-	int size;
-
-	double *buffer = get_results(&size);
-	double *recvbuf = (double *) malloc(size * allnodes * sizeof(*recvbuf));
+void run_queue_init(OUT run_queue_t *queue, int num_runs, int chunk, bool dynamic, int mynode, int allnodes) {
+	/* a single process keeps the counter to itself, so its workers never
+	 * call MPI and it does not need any thread support from the library */
+	queue->dynamic = dynamic && (allnodes > 1);
+	queue->chunk = std::max(1, chunk);
+	queue->counter = NULL;
+	queue->rounds = 0;
+	pthread_mutex_init(&queue->lock, NULL);
+
+	if (!queue->dynamic) {
+		/* blocks of as many runs as it takes to cover num_runs, the last
+		 * processes get fewer (or none) so that no run is simulated twice */
+		queue->rounds = std::max(1, (num_runs + allnodes - 1) / allnodes);
+		queue->next = std::min(num_runs, mynode * queue->rounds);
+		queue->last = std::min(num_runs, queue->next + queue->rounds);
+		queue->num_runs = queue->last - queue->next;
+		return;
+	}
 
-	/*
+	queue->num_runs = num_runs;
+	MPI_Win_allocate((mynode == 0) ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD,
+	                 &queue->counter, &queue->win);
 	if (mynode == 0) {
-		for (int p=1; p<allnodes; p++) {
-			MPI_Status status;
-			MPI_Recv(buffer, size, MPI_DOUBLE, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-			insert_results(buffer, size);
-		}
+		MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, queue->win);
+		*queue->counter = 0;
+		MPI_Win_unlock(0, queue->win);
 	}
-	else {
-		MPI_Send(buffer, size, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-	}
-*/
-	MPI_Gather(buffer, size, MPI_DOUBLE, recvbuf, size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-	if (mynode == 0) {
-		insert_results(recvbuf, size * allnodes);
+	MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/* Takes the next chunk of runs, returns false if all runs are taken */
+bool run_queue_next(IN OUT run_queue_t *queue, OUT int *first, OUT int *count) {
+	int chunk = queue->chunk;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->dynamic) {
+		MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, queue->win);
+		MPI_Fetch_and_op(&chunk, first, MPI_INT, 0, 0, MPI_SUM, queue->win);
+		MPI_Win_unlock(0, queue->win);
+		*count = std::min(chunk, queue->num_runs - *first);
+	} else {
+		*first = queue->next;
+		*count = std::min(chunk, queue->last - queue->next);
+		queue->next += std::max(0, *count);
 	}
+	pthread_mutex_unlock(&queue->lock);
+	return *count > 0;
+}
+
+void run_queue_free(IN OUT run_queue_t *queue) {
+	if (queue->dynamic)
+		MPI_Win_free(&queue->win);
+	pthread_mutex_destroy(&queue->lock);
 }
 
 void generate_namelist_by_name(IN char *method,
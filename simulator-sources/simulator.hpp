@@ -4,9 +4,13 @@
 #include <stdarg.h>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <utility>
 #include <string>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <mpi.h>
 #include "cmdline.h"
 #include "MersenneTwister.h"
 
@@ -58,38 +62,297 @@ typedef int_pair_vec_t ptrn_t;
 typedef std::pair<std::string, std::string> edge_t; 
 typedef int edgeid_t;
 
+/* dense ids assigned by build_topology, see topology.hpp */
+typedef int nodeid_t;
+typedef int hostid_t;
+
 typedef std::vector<edge_t> route_t;
-typedef std::vector<edgeid_t> uroute_t;
 
-typedef std::vector<edge_t> named_ptrn_t;
+/* A route is the list of edge ids from the source to the destination. The
+ * edges live in an inline buffer, so a route object never touches the heap
+ * as long as it has at most ROUTE_INLINE_HOPS edges. Routes are bounded by
+ * the diameter of the fabric, which stays far below that for real networks
+ * (a fat tree needs twice its number of levels, a 3D torus of 16^3 nodes
+ * 24 hops plus the two host links). Longer routes spill into a vector on
+ * the heap, so any length works, just slower. */
+#define ROUTE_INLINE_HOPS 32
 
-class used_edge_t {
+class uroute_t {
 public:
-	edge_t edge;
-	int usage;
-	std::vector<edge_t> peers; /* all the terminal-nodes that use this edge */
+	typedef edgeid_t *iterator;
+
+	uroute_t() : len(0) {}
+
+	iterator begin() { return (len > ROUTE_INLINE_HOPS) ? &spill[0] : edges; }
+	iterator end() { return begin() + len; }
+	size_t size() const { return len; }
+	bool empty() const { return len == 0; }
+	edgeid_t &operator[](size_t i) { return begin()[i]; }
+	edgeid_t &back() { return begin()[len - 1]; }
+	void clear() { len = 0; }
 
-	bool operator<(used_edge_t b) const {
-		if(usage < b.usage) return true;
-		else return false;
+	void push_back(edgeid_t edgeid) {
+		if (len < ROUTE_INLINE_HOPS) {
+			edges[len] = edgeid;
+		} else {
+			if (len == ROUTE_INLINE_HOPS) spill.assign(edges, edges + len);
+			spill.push_back(edgeid);
+		}
+		len++;
 	}
+
+	void assign(const edgeid_t *first, const edgeid_t *last) {
+		clear();
+		for (; first != last; ++first) push_back(*first);
+	}
+
+private:
+	size_t len;
+	edgeid_t edges[ROUTE_INLINE_HOPS];
+	std::vector<edgeid_t> spill;
 };
 
-typedef std::vector<used_edge_t> used_edges_t;
-typedef std::map<edgeid_t, int> cable_cong_map_t;
-typedef std::vector<std::string> namelist_t;
+typedef std::vector<edge_t> named_ptrn_t;
+
+/* The congestion of the edges: one counter per edge id, plus the list of
+ * edges whose counter is not zero, so that clearing the state after a
+ * level only costs as much as the level touched.
+ *
+ * The load of an edge within one level is bounded by the number of pairs,
+ * so the counters come in three widths and only the array of the current
+ * width is in use (the others are all zero). Small counters keep the
+ * working set of large fabrics in the cache; add_pattern_loads picks the
+ * width and widens the counters if they get close to saturation. The
+ * counters are sized by cable_cong_clear, which has to be called before
+ * the first use (a new map has no counters and width 0).
+ *
+ * When several runs are evaluated together (add_lane_loads), every edge
+ * has one counter per run (lane) and the counters of an edge are adjacent:
+ * the counter of edge e in lane l is e * lanes + l, and touched holds these
+ * counter indexes. With a single lane both are simply edge ids. */
+typedef struct {
+	int width = 0;                   /* bytes per counter: 1, 2 or 4 */
+	int lanes = 1;                   /* counters per edge */
+	std::vector<uint8_t> load8;      /* edge id -> number of routes using it */
+	std::vector<uint16_t> load16;
+	std::vector<uint32_t> load32;
+	std::vector<size_t> touched;     /* counters > 0, in order of first use */
+} cable_cong_map_t;
+
+/* The routes of all pairs of a pattern level, stored back to back: the
+ * route of pair i is edges[offset[i]] .. edges[offset[i+1]-1] */
+typedef struct {
+	std::vector<edgeid_t> edges;
+	std::vector<unsigned int> offset;   /* num_pairs + 1 entries */
+} route_arena_t;
+
+/* A bucket queue of the edges by load, for consumers that change loads up
+ * and down and need the maximum after every change (the placement search).
+ * bucket[l] holds the edges with load l > 0 in no particular order. Only
+ * the edges with a load are in slot, so a queue takes memory for the
+ * edges its routes use and not for the whole topology (the placement keeps
+ * one queue for every level). Moving an edge between buckets is O(1) and
+ * max follows the highest non-empty bucket down, so the maximum is O(1)
+ * plus the empty loads below a load that went away. The buckets go up to
+ * the highest load seen, so this is meant for loads that are bounded by
+ * the number of pairs of a level, not for weighted sums. */
+typedef struct {
+	int load;
+	int pos;                                    /* index in bucket[load] */
+} cong_slot_t;
+
+typedef struct {
+	std::unordered_map<edgeid_t, cong_slot_t> slot; /* edge id -> load, edges with load > 0 */
+	std::vector<std::vector<edgeid_t> > bucket;     /* load -> edges */
+	int max;
+} cong_queue_t;
+
+/* Adds delta (which may be negative) to the load of an edge */
+inline void cong_queue_add(cong_queue_t *q, edgeid_t edgeid, int delta) {
+	cong_slot_t *slot = &q->slot[edgeid];
+	int load = slot->load;
+	int newload = load + delta;
+
+	if (load > 0) {
+		std::vector<edgeid_t> *b = &q->bucket[load];
+		edgeid_t last = b->back();
+
+		(*b)[slot->pos] = last;
+		q->slot[last].pos = slot->pos;
+		b->pop_back();
+	}
+	if (newload > 0) {
+		if (newload >= (int) q->bucket.size())
+			q->bucket.resize(newload + 1);
+		slot->load = newload;
+		slot->pos = q->bucket[newload].size();
+		q->bucket[newload].push_back(edgeid);
+	} else {
+		q->slot.erase(edgeid);
+	}
+	if (newload > q->max)
+		q->max = newload;
+	while ((q->max > 0) && q->bucket[q->max].empty())
+		q->max--;
+}
+
+inline int cong_queue_max(cong_queue_t *q) {
+	return q->max;
+}
+
+/* The host pairs of one pattern level of several runs that are evaluated
+ * together, run l of the batch is lane l. Pair i goes from src[i] to dst[i]
+ * (host ids) and belongs to lane[i]. */
+typedef struct {
+	int lanes;
+	std::vector<hostid_t> src;
+	std::vector<hostid_t> dst;
+	std::vector<unsigned char> lane;
+} lane_pairs_t;
+
+/* The number of runs the driver evaluates together */
+#define MULTIRUN_LANES 8
+
+/* The runs are handed out to the workers of all processes in chunks of
+ * consecutive run indices. The index of the next chunk is a counter in an
+ * MPI window on process 0 that every worker increments with an atomic
+ * fetch-and-add, so fast processes simply take more chunks and exactly
+ * num_runs runs are simulated. The workers of a process take turns with
+ * the window (MPI_THREAD_SERIALIZED). A static queue hands every process
+ * one block of rounds consecutive runs (the last processes get fewer, so
+ * that exactly num_runs runs are simulated), for the options that need the
+ * processes to go through their runs in lock step, and for a single
+ * process, where the block is all runs and no window is needed. */
+typedef struct {
+	bool dynamic;
+	int num_runs;                   /* runs in total (dynamic) or of this process (static) */
+	int rounds;                     /* runs of the largest block (static) */
+	int chunk;                      /* runs per chunk */
+	int next;                       /* next run of a static queue */
+	int last;                       /* end of the block of a static queue */
+	int *counter;                   /* the counter on process 0 */
+	MPI_Win win;
+	pthread_mutex_t lock;
+} run_queue_t;
+
+/* The results of the processes are combined on process 0 with collectives
+ * (exchange_results_by_metric). Dense arrays (histograms and per-edge
+ * counters) are reduced element by element, the processes first agree on
+ * the longest length. Lists of variable length (results, hot links) are
+ * gathered in rank order. */
+template <typename T>
+inline void reduce_dense(IN OUT std::vector<T> *values, MPI_Datatype type, MPI_Op op, int mynode) {
+	long size = values->size(), max_size = 0;
+
+	MPI_Allreduce(&size, &max_size, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+	if (max_size == 0)
+		return;
+	values->resize(max_size, 0);
+	if (mynode == 0)
+		MPI_Reduce(MPI_IN_PLACE, &(*values)[0], max_size, type, op, 0, MPI_COMM_WORLD);
+	else
+		MPI_Reduce(&(*values)[0], NULL, max_size, type, op, 0, MPI_COMM_WORLD);
+}
+
+template <typename T>
+inline void gather_list(IN std::vector<T> *local, MPI_Datatype type, OUT std::vector<T> *all, int mynode,
+                        int allnodes) {
+	std::vector<int> counts(allnodes, 0), displs(allnodes, 0);
+	int size = local->size(), total = 0;
+
+	MPI_Gather(&size, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (mynode == 0) {
+		for (int i = 0; i < allnodes; i++) {
+			displs[i] = total;
+			total += counts[i];
+		}
+	}
+	all->resize(total + 1);
+	MPI_Gatherv(local->empty() ? NULL : &(*local)[0], size, type, &(*all)[0], &counts[0], &displs[0], type, 0,
+	            MPI_COMM_WORLD);
+	all->resize(total);
+}
+
+/* A level with at least LEVEL_SPLIT_PAIRS pairs per thread is routed and
+ * evaluated by up to level_threads threads (see add_lane_loads) */
+#define LEVEL_SPLIT_PAIRS 8192
+
+/* The counter array of a given width, for kernels templated on it */
+template <typename T> inline T *cable_cong_counters(cable_cong_map_t *cable_cong);
+template <> inline uint8_t *cable_cong_counters<uint8_t>(cable_cong_map_t *cable_cong) { return &cable_cong->load8[0]; }
+template <> inline uint16_t *cable_cong_counters<uint16_t>(cable_cong_map_t *cable_cong) { return &cable_cong->load16[0]; }
+template <> inline uint32_t *cable_cong_counters<uint32_t>(cable_cong_map_t *cable_cong) { return &cable_cong->load32[0]; }
+
+inline uint32_t cable_cong_get(cable_cong_map_t *cable_cong, edgeid_t edgeid) {
+	switch (cable_cong->width) {
+	case 1: return cable_cong->load8[edgeid];
+	case 2: return cable_cong->load16[edgeid];
+	default: return cable_cong->load32[edgeid];
+	}
+}
+
+/* Only for 4 byte counters */
+inline void cable_cong_add(cable_cong_map_t *cable_cong, edgeid_t edgeid, uint32_t n) {
+	assert(cable_cong->width == 4);
+	if (cable_cong->load32[edgeid] == 0)
+		cable_cong->touched.push_back(edgeid);
+	cable_cong->load32[edgeid] += n;
+}
+
+typedef std::vector<hostid_t> namelist_t;
 typedef std::vector<unsigned long long> guidlist_t;
 
+/* weight -> number of pairs (see insert_into_bucket_maxcon2) */
+typedef std::vector<int> bucket_t;
+
+/* One of the most congested links of a level: its load in one run and
+ * the pairs whose routes used it, four ints per pair (source rank,
+ * destination rank, source host id, destination host id) */
+typedef struct {
+	int load;
+	int run;
+	edgeid_t edge;
+	std::vector<int> flows;
+} hot_link_t;
+
+/* Everything one worker accumulates while it simulates runs. Workers never
+ * share an accumulator, so they need no locks; merge_stats combines them
+ * into the results of the process at the end. The results carry the index
+ * of their run and are merged in run order, so the output does not depend
+ * on which worker simulated which run.
+ *
+ * The per-run state is kept per lane (see simulation_multirun_with_metric),
+ * a worker that simulates one run at a time only uses lane 0. The scratch
+ * space of the metrics (counters and route arenas) is thread_local. With
+ * --hot_links the k most congested links of every level are kept in hot
+ * (see record_hot_links), they are merged in the same deterministic way. */
+typedef struct {
+	int first_run;                      /* run index of lane 0 */
+	int level;                          /* level of the runs in progress */
+	std::vector<bucket_t> run_bucket;   /* lane -> weights of the run so far (hist_acc_band) */
+	std::vector<int> run_sum;           /* lane -> sum of the maximum congestions so far (sum_max_cong) */
+	bucket_t bigbucket;                 /* weight -> number of pairs, all runs */
+	std::vector<int> result_run;        /* result i belongs to run result_run[i] */
+	std::vector<double> results;
+	int hot_links;                      /* hot links kept per level, 0 if they are not recorded */
+	std::vector<std::vector<hot_link_t> > hot;  /* level -> the hottest links over all runs */
+} stats_acc_t;
+
 /* prototypes */
 void merge_two_patterns_into_one(ptrn_t *ptrn1, ptrn_t *ptrn2, int comm1_size, ptrn_t *ptrn_res);
 void exchange_results_sum_max_cong(int mynode, int allnodes);
 void exchange_results_hist_max_cong(int mynode, int allnodes);
+void exchange_results_get_cable_cong(int mynode, int allnodes);
 void exchange_results_by_metric(char *metric_name, int mynode, int allnodes);
-void simulation_with_metric(char *metric_name, ptrn_t *ptrn, namelist_t *namelist, int state);
-void simulation_hist_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state);
-void simulation_hist_effective_bandwidth(ptrn_t *ptrn, namelist_t *namelist, int state);
-void simulation_sum_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state);
-void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int valid_until, int myrank);
+void exchange_hot_links(int mynode, int allnodes, int k);
+void simulation_with_metric(char *metric_name, ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc);
+void simulation_multirun_with_metric(char *metric_name, std::vector<ptrn_t> *ptrns,
+                                     std::vector<namelist_t> *namelists, int state, stats_acc_t *acc);
+void simulation_hist_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc);
+void simulation_hist_effective_bandwidth(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc);
+void simulation_sum_max_cong(ptrn_t *ptrn, namelist_t *namelist, int state, stats_acc_t *acc);
+void simulation_dep_max_delay(cmdargs_t *cmdargs, namelist_t *namelist, int valid_until, int myrank,
+                              stats_acc_t *acc);
 void simulation_get_cable_cong(ptrn_t *ptrn, namelist_t *namelist, int state);
 void print_commandline_options(FILE *fd, cmdargs_t *cmdargs);
 void print_results(cmdargs_t *cmdargs, int mynode, int allnodes);
@@ -107,10 +370,8 @@ void generate_linear_namelist_guid_order(OUT namelist_t *namelist,
                                          IN int comm_size,
                                          IN namelist_t *namelist_pool,
                                          IN bool asc = true);
-void shuffle_namelist(namelist_t *namelist);
-void simulate(used_edges_t *edge_list,  ptrn_t *ptrn, int num_runs);
-void find_route(uroute_t *route, std::string n1, std::string n2);
-int contains_target(char *comment, char *target);
+void shuffle_namelist(namelist_t *namelist, MTRand *mtrand);
+void find_route(uroute_t *route, hostid_t src, hostid_t dst);
 unsigned long long convert_nodename_to_guid(std::string nodename);
 void get_guidlist_from_namelist(IN namelist_t *namelist,
                                 OUT guidlist_t *guidlist);
@@ -129,10 +390,15 @@ void bcast_namelist(namelist_t *namelist, int my_mpi_rank);
 void print_namelist_from_all(IN namelist_t *namelist,
                              IN int my_mpi_rank,
                              IN int commsize);
-void exchange_results2(int mynode, int allnodes);
+void run_queue_init(OUT run_queue_t *queue, int num_runs, int chunk, bool dynamic, int mynode, int allnodes);
+bool run_queue_next(IN OUT run_queue_t *queue, OUT int *first, OUT int *count);
+void run_queue_free(IN OUT run_queue_t *queue);
 void insert_route_into_cable_cong_map(cable_cong_map_t *cable_cong, uroute_t *route);
-void get_max_congestion(uroute_t *route, cable_cong_map_t *cable_cong, int *weight);
-void tag_edges(Agraph_t *mygraph);
+void cable_cong_clear(cable_cong_map_t *cable_cong, int width, int lanes);
+void cable_cong_widen(cable_cong_map_t *cable_cong);
+void run_parallel(int threads, void (*fn)(void *arg, int index), void *arg);
+int get_level_shards(size_t pairs);
+void cong_queue_init(cong_queue_t *q);
 void allreduce_contig_int_map(std::map<int,int> *map);
 void write_graph_with_congestions();
 
@@ -162,5 +428,7 @@ inline void print_once(bool respect_print_once, const char *fmt, ...) {
 #define MYGLOBALS
 extern Agraph_t *mygraph;
 #endif
+extern int level_threads;
+extern int mpi_thread_support;
 
 #endif
@@ -12,6 +12,7 @@
 #include <cmath>
 #include <stdio.h>
 #include <map>
+#include <algorithm>
 #include <assert.h>
 #include <string.h>
 #include <cgraph.h>
@@ -19,57 +20,131 @@
 #include "pattern_generator.hpp"
 #include "simulator.hpp"
 #include "statistics.hpp"
+#include "topology.hpp"
 
 std::vector<double> acc_bandwidths;
+std::vector<int> acc_runs;      /* result i belongs to run acc_runs[i] */
 bucket_t bigbucket;
 cable_cong_map_t cable_cong_global;
+static int cable_cong_global_max = 0;
+std::vector<std::vector<hot_link_t> > hot_links;   /* level -> the hottest links over all runs */
+
+/* The summary of the get_cable_cong metric is kept up to date while the
+ * levels are applied, so it costs O(links used by the level) per level and
+ * printing it does not have to look at all links of the fabric. The top
+ * lists hold the k highest links by accumulated congestion and by the
+ * highest congestion of a single level, ordered by value (highest first)
+ * and edge id. Both values only grow, so a link that is not in a list can
+ * only get into it by passing the last one, which keeps the lists exact. */
+typedef struct {
+	std::vector<edgeid_t> edges;
+	std::vector<bool> member;       /* edge id -> in edges */
+} top_links_t;
+
+static int top_links_k = 10;
+static top_links_t top_acc, top_peak;
+static std::vector<uint32_t> cable_cong_peak;          /* edge id -> highest congestion of a level */
+static std::vector<long> tier_hist[LINK_TIERS];        /* congestion -> number of links and levels */
+
+void set_top_links(int k) {
+	top_links_k = std::max(0, k);
+}
 
-int *get_bigbucket(int *size) {
-	
-	int *buffer = NULL;
+static inline bool top_link_before(std::vector<uint32_t> *value, edgeid_t a, edgeid_t b) {
+	return ((*value)[a] != (*value)[b]) ? ((*value)[a] > (*value)[b]) : (a < b);
+}
+
+/* The value of edge e has grown, moves it up in (or into) the list */
+static void update_top_links(top_links_t *top, std::vector<uint32_t> *value, edgeid_t e) {
+	int pos;
 
-	*size = bigbucket.size();
-	if (*size > 0) {
-		buffer = (int *) malloc(bigbucket.size() * sizeof(*buffer));
-		for (int i = 0; i<bigbucket.size(); i++)
-			buffer[i] = bigbucket.at(i);
+	if (top->member[e]) {
+		pos = std::find(top->edges.begin(), top->edges.end(), e) - top->edges.begin();
+	} else {
+		if ((int) top->edges.size() >= top_links_k) {
+			if ((top_links_k == 0) || !top_link_before(value, e, top->edges.back()))
+				return;
+			top->member[top->edges.back()] = false;
+			top->edges.pop_back();
+		}
+		top->member[e] = true;
+		top->edges.push_back(e);
+		pos = top->edges.size() - 1;
 	}
-	return buffer;
+	for (; (pos > 0) && top_link_before(value, e, top->edges[pos - 1]); pos--)
+		top->edges[pos] = top->edges[pos - 1];
+	top->edges[pos] = e;
 }
 
-double *get_results(int *size) {
-	
-	double *results = NULL;
-
-	*size = acc_bandwidths.size();
-	if (*size > 0) {
-		results = (double *) malloc(acc_bandwidths.size() * sizeof(*results));
-		for (int i = 0; i<acc_bandwidths.size(); i++)
-			results[i] = acc_bandwidths.at(i);
+static void cable_cong_global_init() {
+	if (cable_cong_global.width != 4) {
+		cable_cong_clear(&cable_cong_global, 4, 1);
+		cable_cong_peak.assign(get_num_edges(), 0);
+		top_acc.member.assign(get_num_edges(), false);
+		top_peak.member.assign(get_num_edges(), false);
 	}
-	return results;
 }
 
-void apply_cable_cong_map_to_global_cable_cong_map(cable_cong_map_t *cable_cong) {
+/* Adds the routes of a level to the global map. The congestion of the
+ * level used to be applied to the global map after every single pair, so
+ * the route of pair j (of n) is added with weight n - j. cable_cong holds
+ * the plain loads of the level (one lane) and arena its routes. */
+void apply_cable_cong_map_to_global_cable_cong_map(cable_cong_map_t *cable_cong, route_arena_t *arena) {
 	
-	cable_cong_map_t::iterator iter;
+	std::vector<size_t>::iterator iter;
+	size_t pairs = arena->offset.size() - 1;
 
-	for (iter = cable_cong->begin(); iter != cable_cong->end(); ++iter) {
-		std::pair<cable_cong_map_t::iterator, bool> ret;
-		ret = cable_cong_global.insert(std::make_pair(iter->first, iter->second));
-		if (ret.second == false) {
-			ret.first->second += iter->second;
+	cable_cong_global_init();
+	for (size_t pair = 0; pair < pairs; pair++) {
+		for (unsigned int e = arena->offset[pair]; e < arena->offset[pair + 1]; e++)
+			cable_cong_add(&cable_cong_global, arena->edges[e], pairs - pair);
+	}
+
+	/* the loads only grow, so the maximum is kept up to date here */
+	for (iter = cable_cong->touched.begin(); iter != cable_cong->touched.end(); ++iter) {
+		uint32_t load = cable_cong_get(cable_cong, *iter);
+		std::vector<long> *hist = &tier_hist[mytopology.edge_tier[*iter]];
+
+		if (hist->size() <= load)
+			hist->resize(load + 1, 0);
+		(*hist)[load]++;
+
+		if (load > cable_cong_peak[*iter]) {
+			cable_cong_peak[*iter] = load;
+			update_top_links(&top_peak, &cable_cong_peak, *iter);
 		}
+		update_top_links(&top_acc, &cable_cong_global.load32, *iter);
+		if ((int) cable_cong_global.load32[*iter] > cable_cong_global_max)
+			cable_cong_global_max = cable_cong_global.load32[*iter];
 	}
 }
 
-void insert_results(double *buffer, int size) {
-	acc_bandwidths.clear();
-	for (int i = 0; i < size; i++) {
-		acc_bandwidths.push_back(buffer[i]);
+/* Collects the results of all processes on process 0 in run order */
+void gather_results(int mynode, int allnodes) {
+	std::vector<double> results;
+	std::vector<int> runs;
+
+	gather_list(&acc_bandwidths, MPI_DOUBLE, &results, mynode, allnodes);
+	gather_list(&acc_runs, MPI_INT, &runs, mynode, allnodes);
+	if (mynode != 0)
+		return;
+
+	std::vector<std::pair<int, double> > order(results.size());
+	for (size_t i = 0; i < results.size(); i++)
+		order[i] = std::make_pair(runs[i], results[i]);
+	std::sort(order.begin(), order.end());
+	acc_runs.resize(order.size());
+	acc_bandwidths.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		acc_runs[i] = order[i].first;
+		acc_bandwidths[i] = order[i].second;
 	}
 }
 
+void reduce_bigbucket(int mynode) {
+	reduce_dense(&bigbucket, MPI_INT, MPI_SUM, mynode);
+}
+
 void add_to_bigbucket(int *buffer, int size) {
 	for (int count = 0; count < size; count++) {
 		if (bigbucket.size() < size) {bigbucket.resize(size, 0);}
@@ -77,33 +152,320 @@ void add_to_bigbucket(int *buffer, int size) {
 	}
 }
 
-void insert_into_bucket_maxcon2(cable_cong_map_t *cable_cong, ptrn_t *ptrn, namelist_t *namelist, bucket_t *bucket) {
+template <typename T>
+static void insert_into_bucket_maxcon2_scan(T *load, route_arena_t *arena, int lanes, unsigned char *lane,
+                                            size_t first, size_t last, bucket_t *buckets, bucket_t *bigbucket) {
 
-	ptrn_t::iterator iter_ptrn;
-	for (iter_ptrn = ptrn->begin(); iter_ptrn != ptrn->end(); ++iter_ptrn) {
-		/* we need to re-generate the route ... this could also be
-		* stored in the previous step
-		* timos: I don't think so, It would be better to implement a "cache"
-		* into find route */
-		uroute_t route;
-		find_route(&route, namelist->at(iter_ptrn->first), namelist->at(iter_ptrn->second));
+	/* the routes of the level were recorded by add_lane_loads, so this is
+	 * a linear scan over the arena */
+	for (size_t pair = first; pair < last; pair++) {
+		int l = (lane != NULL) ? lane[pair] : 0;
+		bucket_t *bucket = &buckets[l];
+		int weight = 0;
+
+		for (unsigned int i = arena->offset[pair]; i < arena->offset[pair + 1]; i++) {
+			size_t counter = (size_t) arena->edges[i] * lanes + l;
+			if (weight < load[counter]) weight = load[counter];
+		}
 
-		int weight;
-		//get_max_congestion(&route, edge_list, &weight);
-		get_max_congestion(&route, cable_cong, &weight);
 		if (bucket->size() < weight + 1) {
 			bucket->resize(weight + 10, 0);
-			//bucket->at(weight) = 0;
 		}
 		bucket->at(weight) = bucket->at(weight) + 1;
 
 		/* The smae for bigbucket */
-		if (bigbucket.size() < weight + 1) {
-			bigbucket.resize(weight + 10, 0);
+		if (bigbucket->size() < weight + 1) {
+			bigbucket->resize(weight + 10, 0);
+		}
+		bigbucket->at(weight) = bigbucket->at(weight) + 1;
+	}
+}
+
+static void insert_range_into_buckets_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, unsigned char *lane,
+                                              size_t first, size_t last, bucket_t *buckets, bucket_t *bigbucket) {
+	int lanes = cable_cong->lanes;
+
+	switch (cable_cong->width) {
+	case 1: insert_into_bucket_maxcon2_scan(cable_cong_counters<uint8_t>(cable_cong), arena, lanes, lane, first, last, buckets, bigbucket); break;
+	case 2: insert_into_bucket_maxcon2_scan(cable_cong_counters<uint16_t>(cable_cong), arena, lanes, lane, first, last, buckets, bigbucket); break;
+	default: insert_into_bucket_maxcon2_scan(cable_cong_counters<uint32_t>(cable_cong), arena, lanes, lane, first, last, buckets, bigbucket); break;
+	}
+}
+
+/* The scan of a level that is split among several threads: every thread
+ * fills its own buckets from a contiguous range of the pairs */
+typedef struct {
+	cable_cong_map_t *cable_cong;
+	route_arena_t *arena;
+	unsigned char *lane;
+	int shards;
+	std::vector<std::vector<bucket_t> > buckets;   /* shard -> lane -> weights */
+	std::vector<bucket_t> bigbucket;               /* shard -> weights */
+} level_scan_t;
+
+static void scan_level_shard(void *arg, int shard) {
+	level_scan_t *scan = (level_scan_t *) arg;
+	size_t size = scan->arena->offset.size() - 1;
+
+	scan->buckets[shard].assign(scan->cable_cong->lanes, bucket_t());
+	scan->bigbucket[shard].clear();
+	insert_range_into_buckets_maxcon2(scan->cable_cong, scan->arena, scan->lane, size * shard / scan->shards,
+	                                  size * (shard + 1) / scan->shards, &scan->buckets[shard][0],
+	                                  &scan->bigbucket[shard]);
+}
+
+static void add_bucket(bucket_t *to, bucket_t *from) {
+	if (to->size() < from->size())
+		to->resize(from->size(), 0);
+	for (size_t i = 0; i < from->size(); i++)
+		(*to)[i] += (*from)[i];
+}
+
+static void insert_into_buckets_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, unsigned char *lane,
+                                        bucket_t *buckets, bucket_t *bigbucket) {
+	static thread_local level_scan_t scan;
+	size_t size = arena->offset.empty() ? 0 : arena->offset.size() - 1;
+	int shards = get_level_shards(size);
+
+	if (shards <= 1) {
+		insert_range_into_buckets_maxcon2(cable_cong, arena, lane, 0, size, buckets, bigbucket);
+		return;
+	}
+
+	scan.cable_cong = cable_cong;
+	scan.arena = arena;
+	scan.lane = lane;
+	scan.shards = shards;
+	scan.buckets.resize(shards);
+	scan.bigbucket.resize(shards);
+	run_parallel(shards, scan_level_shard, &scan);
+
+	/* the histograms are counts, their sum does not depend on the split */
+	for (int s = 0; s < shards; s++) {
+		for (int l = 0; l < cable_cong->lanes; l++)
+			add_bucket(&buckets[l], &scan.buckets[s][l]);
+		add_bucket(bigbucket, &scan.bigbucket[s]);
+	}
+}
+
+void insert_into_bucket_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, bucket_t *bucket,
+                                stats_acc_t *acc) {
+	insert_into_buckets_maxcon2(cable_cong, arena, NULL, bucket, &acc->bigbucket);
+}
+
+void insert_into_lane_buckets_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, lane_pairs_t *pairs,
+                                      bucket_t *buckets, stats_acc_t *acc) {
+	insert_into_buckets_maxcon2(cable_cong, arena, pairs->lane.empty() ? NULL : &pairs->lane[0], buckets,
+	                            &acc->bigbucket);
+}
+
+/* Starts the next runs of a worker: lane l simulates run first_run + l */
+void stats_acc_begin_runs(stats_acc_t *acc, int first_run, int lanes) {
+	acc->first_run = first_run;
+	acc->run_bucket.assign(lanes, bucket_t());
+	acc->run_sum.assign(lanes, 0);
+}
+
+/* Hot link attribution
+ *
+ * To tell which pairs caused the maximum congestion of a level, the k most
+ * congested links of every level are kept together with the pairs whose
+ * routes used them. The loads of the level are the first counting pass,
+ * so the link to pairs index is built in CSR form with a single pass over
+ * the routes of the level (the arena), and only for the links that make it
+ * into the list of their level. A link of one run is ordered before
+ * another one if its load is higher, then by run and edge id, so the lists
+ * do not depend on the order the runs were simulated in.
+ */
+static bool hot_link_before(const hot_link_t &a, const hot_link_t &b) {
+	if (a.load != b.load) return a.load > b.load;
+	if (a.run != b.run) return a.run < b.run;
+	return a.edge < b.edge;
+}
+
+/* Keeps the k first links of list, returns false if link would not be among them */
+static bool hot_link_qualifies(std::vector<hot_link_t> *list, int k, hot_link_t *link) {
+	return ((int) list->size() < k) || hot_link_before(*link, list->back());
+}
+
+static void insert_hot_link(std::vector<hot_link_t> *list, int k, hot_link_t *link) {
+	std::vector<hot_link_t>::iterator pos = std::upper_bound(list->begin(), list->end(), *link, hot_link_before);
+
+	list->insert(pos, *link);
+	if ((int) list->size() > k)
+		list->pop_back();
+}
+
+/* orders edges by load (highest first), then by id */
+struct edge_load_before {
+	cable_cong_map_t *cable_cong;
+
+	bool operator()(edgeid_t a, edgeid_t b) const {
+		uint32_t la = cable_cong_get(cable_cong, a), lb = cable_cong_get(cable_cong, b);
+		return (la != lb) ? (la > lb) : (a < b);
+	}
+};
+
+void record_hot_links(cable_cong_map_t *cable_cong, route_arena_t *arena, ptrn_t *ptrn, namelist_t *namelist,
+                      stats_acc_t *acc) {
+	static thread_local std::vector<int> slot;           /* edge id -> index in candidates, -1 if none */
+	static thread_local std::vector<int> offset, fill, flows;
+	std::vector<edgeid_t> candidates(cable_cong->touched.begin(), cable_cong->touched.end());
+	std::vector<hot_link_t> *list;
+	int k = acc->hot_links, count, i;
+
+	if ((int) acc->hot.size() <= acc->level)
+		acc->hot.resize(acc->level + 1);
+	list = &acc->hot[acc->level];
+
+	/* the k most congested links of the level, and of those the ones that
+	 * are among the hottest of all runs so far */
+	count = std::min(k, (int) candidates.size());
+	edge_load_before order = {cable_cong};
+	std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), order);
+	candidates.resize(count);
+	for (i = 0; i < (int) candidates.size(); ) {
+		hot_link_t link;
+
+		link.load = cable_cong_get(cable_cong, candidates[i]);
+		link.run = acc->first_run;
+		link.edge = candidates[i];
+		if (hot_link_qualifies(list, k, &link)) i++;
+		else candidates.erase(candidates.begin() + i);
+	}
+	if (candidates.empty())
+		return;
+
+	/* CSR over the candidates, the counts are their loads */
+	slot.resize(get_num_edges(), -1);
+	offset.assign(candidates.size() + 1, 0);
+	for (i = 0; i < (int) candidates.size(); i++) {
+		slot[candidates[i]] = i;
+		offset[i + 1] = offset[i] + cable_cong_get(cable_cong, candidates[i]);
+	}
+	fill.assign(offset.begin(), offset.end() - 1);
+	flows.resize(offset.back());
+	for (size_t pair = 0; pair + 1 < arena->offset.size(); pair++) {
+		for (unsigned int e = arena->offset[pair]; e < arena->offset[pair + 1]; e++) {
+			int c = slot[arena->edges[e]];
+			if (c >= 0) flows[fill[c]++] = pair;
+		}
+	}
+
+	for (i = 0; i < (int) candidates.size(); i++) {
+		hot_link_t link;
+
+		link.load = offset[i + 1] - offset[i];
+		link.run = acc->first_run;
+		link.edge = candidates[i];
+		for (int f = offset[i]; f < offset[i + 1]; f++) {
+			int_pair_t *pair = &(*ptrn)[flows[f]];
+			link.flows.push_back(pair->first);
+			link.flows.push_back(pair->second);
+			link.flows.push_back(namelist->at(pair->first));
+			link.flows.push_back(namelist->at(pair->second));
 		}
-		bigbucket.at(weight) = bigbucket.at(weight) + 1;
+		insert_hot_link(list, k, &link);
+		slot[candidates[i]] = -1;
 	}
+}
 
+static void merge_hot_links(std::vector<std::vector<hot_link_t> > *from, int k) {
+	if (hot_links.size() < from->size())
+		hot_links.resize(from->size());
+	for (size_t l = 0; l < from->size(); l++) {
+		for (size_t i = 0; i < (*from)[l].size(); i++) {
+			if (hot_link_qualifies(&hot_links[l], k, &(*from)[l][i]))
+				insert_hot_link(&hot_links[l], k, &(*from)[l][i]);
+		}
+	}
+}
+
+/* Packs the hot links into one buffer of ints: per link the level, load,
+ * run, edge id and number of flows, followed by the flows */
+void get_hot_links(std::vector<int> *buffer) {
+	buffer->clear();
+	for (size_t l = 0; l < hot_links.size(); l++) {
+		for (size_t i = 0; i < hot_links[l].size(); i++) {
+			hot_link_t *link = &hot_links[l][i];
+
+			buffer->push_back(l);
+			buffer->push_back(link->load);
+			buffer->push_back(link->run);
+			buffer->push_back(link->edge);
+			buffer->push_back(link->flows.size());
+			buffer->insert(buffer->end(), link->flows.begin(), link->flows.end());
+		}
+	}
+}
+
+void insert_hot_links(int *buffer, int size, int k) {
+	std::vector<std::vector<hot_link_t> > links;
+	int pos = 0;
+
+	while (pos < size) {
+		hot_link_t link;
+		int level = buffer[pos];
+
+		link.load = buffer[pos + 1];
+		link.run = buffer[pos + 2];
+		link.edge = buffer[pos + 3];
+		link.flows.assign(buffer + pos + 5, buffer + pos + 5 + buffer[pos + 4]);
+		pos += 5 + buffer[pos + 4];
+
+		if ((int) links.size() <= level)
+			links.resize(level + 1);
+		links[level].push_back(link);
+	}
+	merge_hot_links(&links, k);
+}
+
+void print_hot_links(FILE *fd, int k) {
+
+	fprintf(fd, "\nHot Links (the %d most congested links of every level over all runs)\n", k);
+	fprintf(fd, "===================\n");
+	for (size_t l = 0; l < hot_links.size(); l++) {
+		if (hot_links[l].empty())
+			continue;
+		fprintf(fd, "\nLevel %zu:\n", l);
+		for (size_t i = 0; i < hot_links[l].size(); i++) {
+			hot_link_t *link = &hot_links[l][i];
+
+			fprintf(fd, "  congestion %d in run %d on edge %d: %s -> %s\n", link->load, link->run + 1, link->edge,
+			        get_node_name(get_edge_tail(link->edge)), get_node_name(mytopology.edge_head[link->edge]));
+			for (size_t f = 0; f < link->flows.size(); f += 4)
+				fprintf(fd, "    rank %d -> rank %d (%s -> %s)\n", link->flows[f], link->flows[f + 1],
+				        get_host_name(link->flows[f + 2]), get_host_name(link->flows[f + 3]));
+		}
+	}
+}
+
+/* Adds the accumulators of all workers to the results of this process.
+ * The bigbuckets are simply summed up, the results are appended in run
+ * order. */
+void merge_stats(stats_acc_t *accs, int count) {
+	std::vector<std::pair<int, double> > results;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		add_to_bigbucket(accs[i].bigbucket.empty() ? NULL : &accs[i].bigbucket[0], accs[i].bigbucket.size());
+		for (size_t r = 0; r < accs[i].results.size(); r++)
+			results.push_back(std::make_pair(accs[i].result_run[r], accs[i].results[r]));
+
+		merge_hot_links(&accs[i].hot, accs[i].hot_links);
+
+		accs[i].bigbucket.clear();
+		accs[i].result_run.clear();
+		accs[i].results.clear();
+		accs[i].hot.clear();
+	}
+
+	/* a run is accounted exactly once, so the order is unique */
+	std::sort(results.begin(), results.end());
+	for (size_t r = 0; r < results.size(); r++) {
+		acc_runs.push_back(results[r].first);
+		acc_bandwidths.push_back(results[r].second);
+	}
 }
 
 void print_statistics_max_congestions(FILE *fd) {
@@ -275,9 +637,10 @@ double get_acc_bandwidth(bucket_t *bucket) {
 	}
 }
 
-void account_stats(bucket_t *bucket) {
+void account_stats(stats_acc_t *acc, int lane, bucket_t *bucket) {
 	
-	acc_bandwidths.push_back(get_acc_bandwidth(bucket));
+	acc->result_run.push_back(acc->first_run + lane);
+	acc->results.push_back(get_acc_bandwidth(bucket));
 
 	/*	if (acc_bandwidths.size() > 50) {  // The confidence interval we choose only works for n>50
 		return get_max_error(2.576);
@@ -288,18 +651,13 @@ void account_stats(bucket_t *bucket) {
 */
 }
 
-double account_stats_max_congestions(double max_congestions) {
+void account_stats_max_congestions(stats_acc_t *acc, int lane, double max_congestions) {
 	
-	acc_bandwidths.push_back(max_congestions);
-
-	if (acc_bandwidths.size() > 50) {  // The confidence interval we choose only works for n>50
-		return get_max_error(2.576);
+	acc->result_run.push_back(acc->first_run + lane);
+	acc->results.push_back(max_congestions);
 
-	}
-
-	else {
-		return -1;
-	}
+	/* The confidence interval (get_max_error) only works for n>50 and is
+	 * only known once the workers have been merged */
 }
 
 void printbigbucket(FILE *fd) {
@@ -308,29 +666,112 @@ void printbigbucket(FILE *fd) {
 }
 
 void print_cable_cong(FILE *fd) {
-	cable_cong_map_t::iterator iter;
+	edgeid_t edgeid;
 	
 	fprintf(fd, "\nCable Congestions:\n\n Edge-ID\tacc. cong\n");
-	for (iter = cable_cong_global.begin(); iter != cable_cong_global.end(); ++iter)
-		fprintf(fd, "%i\t%i\n", iter->first, iter->second);
+	for (edgeid = 0; edgeid < (edgeid_t) cable_cong_global.load32.size(); edgeid++)
+		if (cable_cong_global.load32[edgeid] > 0)
+			fprintf(fd, "%i\t%u\n", edgeid, cable_cong_global.load32[edgeid]);
+}
+
+static void print_top_links(FILE *fd, top_links_t *top) {
+	for (size_t i = 0; i < top->edges.size(); i++) {
+		edgeid_t e = top->edges[i];
+
+		fprintf(fd, "%i\t%u\t%u\t%s -> %s\n", e, cable_cong_global.load32[e], cable_cong_peak[e],
+		        get_node_name(get_edge_tail(e)), get_node_name(mytopology.edge_head[e]));
+	}
+}
+
+void print_cable_cong_summary(FILE *fd) {
+	static const char *tier_names[LINK_TIERS] = {"host links", "leaf up-links", "spine links"};
+	int links[LINK_TIERS] = {0}, used[LINK_TIERS] = {0};
+	edgeid_t edgeid;
+
+	for (edgeid = 0; edgeid < get_num_edges(); edgeid++) {
+		links[mytopology.edge_tier[edgeid]]++;
+		if ((edgeid < (edgeid_t) cable_cong_peak.size()) && (cable_cong_peak[edgeid] > 0))
+			used[mytopology.edge_tier[edgeid]]++;
+	}
+
+	/* The accumulated congestion is weighted like the full output (the route
+	 * of pair j of a level with n pairs counts n-j times), everything else
+	 * is the plain number of routes using a link in one level */
+	fprintf(fd, "\nCable Congestion Summary\n========================\n");
+	fprintf(fd, "\nweighted acc. cong: sum over all levels, the route of pair j of a level with n pairs counts n-j times\n");
+	fprintf(fd, "max. cong: highest number of routes using the link in a level\n");
+	fprintf(fd, "\nMaximal weighted accumulated congestion: %d\n", cable_cong_global_max);
+	fprintf(fd, "\nThe %zu links with the highest weighted accumulated congestion:\n\n Edge-ID\tweighted acc. cong\tmax. cong\tlink\n",
+	        top_acc.edges.size());
+	print_top_links(fd, &top_acc);
+	fprintf(fd, "\nThe %zu links with the highest congestion in a level:\n\n Edge-ID\tweighted acc. cong\tmax. cong\tlink\n",
+	        top_peak.edges.size());
+	print_top_links(fd, &top_peak);
+
+	/* how often links of a tier had a congestion in a level (not weighted) */
+	for (int tier = 0; tier < LINK_TIERS; tier++) {
+		fprintf(fd, "\nCongestions in a level of the %s (%d links, %d used):\n", tier_names[tier], links[tier], used[tier]);
+		for (size_t load = 1; load < tier_hist[tier].size(); load++)
+			if (tier_hist[tier][load] > 0)
+				fprintf(fd, "Congestion of %zu occurred %ld times.\n", load, tier_hist[tier][load]);
+	}
+}
+
+/* Sums up the global maps of all processes on process 0 (and takes the
+ * maximum of the highest congestions). The top lists only know the links
+ * of one process, so they are rebuilt from the reduced counters; the
+ * result is the same as if one process had applied all levels. */
+void reduce_cable_cong(int mynode) {
+	edgeid_t edgeid;
+
+	cable_cong_global_init();
+	reduce_dense(&cable_cong_global.load32, MPI_UNSIGNED, MPI_SUM, mynode);
+	reduce_dense(&cable_cong_peak, MPI_UNSIGNED, MPI_MAX, mynode);
+	for (int tier = 0; tier < LINK_TIERS; tier++)
+		reduce_dense(&tier_hist[tier], MPI_LONG, MPI_SUM, mynode);
+	if (mynode != 0)
+		return;
+
+	top_acc.edges.clear();
+	top_acc.member.assign(get_num_edges(), false);
+	top_peak.edges.clear();
+	top_peak.member.assign(get_num_edges(), false);
+	cable_cong_global_max = 0;
+	for (edgeid = 0; edgeid < get_num_edges(); edgeid++) {
+		if (cable_cong_peak[edgeid] == 0)
+			continue;
+		update_top_links(&top_acc, &cable_cong_global.load32, edgeid);
+		update_top_links(&top_peak, &cable_cong_peak, edgeid);
+		if ((int) cable_cong_global.load32[edgeid] > cable_cong_global_max)
+			cable_cong_global_max = cable_cong_global.load32[edgeid];
+	}
 }
 
 int get_congestion_by_edgeid(int eid) {
 
-	cable_cong_map_t::iterator iter = cable_cong_global.find(eid);
-	return iter->second;
+	if (eid >= (int) cable_cong_global.load32.size())
+		return 0;
+	return cable_cong_global.load32[eid];
 
 }
 
 int get_max_from_global_cong_map() {
 
-	cable_cong_map_t::iterator iter;
-	int max=0;
+	return cable_cong_global_max;
+
+}
+
+/* The highest weight that occured. A bucket only grows when a weight does
+ * not fit, to that weight plus 10 (see insert_into_bucket_maxcon2_scan),
+ * so the highest weight is among the last 10 entries. */
+int get_bucket_max(bucket_t *bucket) {
+
+	int count;
 
-	for (iter = cable_cong_global.begin(); iter != cable_cong_global.end(); ++iter) {
-		if (iter->second > max) max = iter->second;
+	for (count = (int) bucket->size() - 1; count > 0; count--) {
+		if (bucket->at(count) > 0) break;
 	}
-	return max;
+	return (count > 0) ? count : 0;
 
 }
 
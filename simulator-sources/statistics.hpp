@@ -1,31 +1,41 @@
 #ifndef STATISTICS_HPP
 #define STATISTICS_HPP
 
-/* Typedefs */
-typedef std::vector<int> bucket_t;
-
 /* Prototypes */
 void print_raw_data(FILE *fd);
 void printbigbucket(FILE *fd);
 void print_cable_cong(FILE *fd);
+void print_cable_cong_summary(FILE *fd);
+void set_top_links(int k);
 double get_avg_bandwidth();
 double get_var_bandwidth(double xq);
 double get_max_error(double quantile);
 double get_acc_bandwidth(bucket_t *bucket);
-void account_stats(bucket_t *bucket);
+void account_stats(stats_acc_t *acc, int lane, bucket_t *bucket);
 void print_bucket(FILE *fd, bucket_t *bucket);
 void print_statistics_max_congestions(FILE *fd);
-double account_stats_max_congestions(double max_congestions);
+void account_stats_max_congestions(stats_acc_t *acc, int lane, double max_congestions);
 void print_histogram(FILE *fd);
-double *get_results(int *size);
-void insert_results(double *buffer, int size);
+void gather_results(int mynode, int allnodes);
+void reduce_bigbucket(int mynode);
+void reduce_cable_cong(int mynode);
 void add_to_bigbucket(int *buffer, int size);
-int *get_bigbucket(int *size);
-void insert_into_bucket_maxcon2(cable_cong_map_t *cable_cong, ptrn_t *ptrn, namelist_t *namelist, bucket_t *bucket);
+void insert_into_bucket_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, bucket_t *bucket,
+                                stats_acc_t *acc);
+void insert_into_lane_buckets_maxcon2(cable_cong_map_t *cable_cong, route_arena_t *arena, lane_pairs_t *pairs,
+                                      bucket_t *buckets, stats_acc_t *acc);
+void stats_acc_begin_runs(stats_acc_t *acc, int first_run, int lanes);
+void merge_stats(stats_acc_t *accs, int count);
+void record_hot_links(cable_cong_map_t *cable_cong, route_arena_t *arena, ptrn_t *ptrn, namelist_t *namelist,
+                      stats_acc_t *acc);
+void get_hot_links(std::vector<int> *buffer);
+void insert_hot_links(int *buffer, int size, int k);
+void print_hot_links(FILE *fd, int k);
 void print_statistics_max_delay(FILE *fd);
 void print_raw_data_max_delay(FILE *fd);
-void apply_cable_cong_map_to_global_cable_cong_map(cable_cong_map_t *cable_cong);
+void apply_cable_cong_map_to_global_cable_cong_map(cable_cong_map_t *cable_cong, route_arena_t *arena);
 int get_congestion_by_edgeid(int eid);
 int get_max_from_global_cong_map();
+int get_bucket_max(bucket_t *bucket);
 
 #endif
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2009 The Trustees of Indiana University and Indiana
+ *                    University Research and Technology
+ *                    Corporation.  All rights reserved.
+ *
+ * Author(s): Timo Schneider <timoschn@cs.indiana.edu>
+ *            Torsten Hoefler <htor@cs.indiana.edu>
+ *
+ */
+
+/* The topology module turns the cgraph representation of the fabric into
+ * a compact snapshot that the simulation works on.
+ *
+ * The dot files describe the routing of the fabric with a comment on every
+ * out edge of a switch that lists all destination hosts routed over that
+ * edge ("*" matches every destination). Scanning these lists on every hop of
+ * every route is very expensive on large fabrics, so we compile them once
+ * into dense per-node forwarding tables (destination host id -> out edge).
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cgraph.h>
+#include "simulator.hpp"
+#include "topology.hpp"
+
+topology_t mytopology;
+
+/* Parses a routing comment and appends its destination set to dst_data */
+static void encode_destinations(const char *comment) {
+	int num_hosts = get_num_hosts();
+	std::vector<hostid_t> hosts;
+	unsigned char kind;
+	size_t i, intervals;
+
+	if (strcmp(comment, "*") == 0) {
+		mytopology.dst_kind.push_back(DSTSET_WILDCARD);
+		mytopology.dst_offset.push_back(mytopology.dst_data.size());
+		return;
+	}
+
+	char *buffer = strdup(comment);
+	char *saveptr;
+	for (char *target = strtok_r(buffer, ", \t\n", &saveptr); target != NULL;
+	     target = strtok_r(NULL, ", \t\n", &saveptr)) {
+		hostid_t host = get_host_id(target);
+		if (host >= 0) hosts.push_back(host);
+	}
+	free(buffer);
+
+	std::sort(hosts.begin(), hosts.end());
+	hosts.erase(std::unique(hosts.begin(), hosts.end()), hosts.end());
+
+	intervals = 0;
+	for (i = 0; i < hosts.size(); i++)
+		if ((i == 0) || (hosts[i] != hosts[i - 1] + 1)) intervals++;
+
+	if (hosts.empty())
+		kind = DSTSET_EMPTY;
+	else if (2 * intervals <= (size_t) (num_hosts + 31) / 32)
+		kind = DSTSET_INTERVALS;
+	else
+		kind = DSTSET_BITSET;
+
+	mytopology.dst_kind.push_back(kind);
+	mytopology.dst_offset.push_back(mytopology.dst_data.size());
+	if (kind == DSTSET_INTERVALS) {
+		for (i = 0; i < hosts.size(); i++) {
+			if ((i == 0) || (hosts[i] != hosts[i - 1] + 1)) {
+				mytopology.dst_data.push_back(hosts[i]);
+				mytopology.dst_data.push_back(hosts[i]);
+			}
+			mytopology.dst_data.back() = hosts[i];
+		}
+	} else if (kind == DSTSET_BITSET) {
+		size_t first = mytopology.dst_data.size();
+		mytopology.dst_data.resize(first + (num_hosts + 31) / 32, 0);
+		for (i = 0; i < hosts.size(); i++)
+			mytopology.dst_data[first + hosts[i] / 32] |= 1u << (hosts[i] % 32);
+	}
+}
+
+/* Declares the attributes of one kind (AGRAPH, AGNODE or AGEDGE) except
+ * the ones in skip, syms gets their cgraph symbols */
+static void declare_dot_attrs(Agraph_t *mygraph, int kind, const char **skip, dot_attrs_t *attrs,
+                              std::vector<Agsym_t *> *syms) {
+	Agsym_t *sym;
+	int i;
+
+	attrs->offset.assign(1, 0);
+	for (sym = agnxtattr(mygraph, kind, NULL); sym != NULL; sym = agnxtattr(mygraph, kind, sym)) {
+		for (i = 0; (skip[i] != NULL) && (strcmp(sym->name, skip[i]) != 0); i++);
+		if (skip[i] != NULL)
+			continue;
+		attrs->names.push_back(sym->name);
+		attrs->defaults.push_back((sym->defval != NULL) ? sym->defval : "");
+		syms->push_back(sym);
+	}
+}
+
+/* Appends the attribute values of the next object */
+static void add_dot_attrs(void *obj, dot_attrs_t *attrs, std::vector<Agsym_t *> *syms) {
+	for (size_t i = 0; i < syms->size(); i++) {
+		char *value = agxget(obj, (*syms)[i]);
+
+		if ((value != NULL) && (attrs->defaults[i] != value)) {
+			attrs->attr.push_back(i);
+			attrs->value.push_back(value);
+		}
+	}
+	attrs->offset.push_back(attrs->value.size());
+}
+
+/* Sorts the edges into the tiers LINK_HOST, LINK_LEAF_UP and LINK_SPINE */
+static void classify_links() {
+	std::vector<bool> leaf(mytopology.node_names.size(), false);
+	nodeid_t n;
+	edgeid_t e;
+
+	for (n = 0; n < (nodeid_t) mytopology.node_names.size(); n++) {
+		for (e = mytopology.out_offset[n]; e < mytopology.out_offset[n + 1]; e++) {
+			nodeid_t head = mytopology.edge_head[e];
+
+			if ((mytopology.host_index[n] >= 0) && (mytopology.host_index[head] < 0)) leaf[head] = true;
+			if ((mytopology.host_index[head] >= 0) && (mytopology.host_index[n] < 0)) leaf[n] = true;
+		}
+	}
+
+	mytopology.edge_tier.resize(mytopology.edge_head.size());
+	for (n = 0; n < (nodeid_t) mytopology.node_names.size(); n++) {
+		for (e = mytopology.out_offset[n]; e < mytopology.out_offset[n + 1]; e++) {
+			nodeid_t head = mytopology.edge_head[e];
+
+			if ((mytopology.host_index[n] >= 0) || (mytopology.host_index[head] >= 0))
+				mytopology.edge_tier[e] = LINK_HOST;
+			else if (leaf[n])
+				mytopology.edge_tier[e] = LINK_LEAF_UP;
+			else
+				mytopology.edge_tier[e] = LINK_SPINE;
+		}
+	}
+}
+
+void build_topology(Agraph_t *mygraph) {
+	Agnode_t *n;
+	Agedge_t *e;
+
+	static const char *no_skip[] = {NULL};
+	static const char *edge_skip[] = {"key", "comment", "edge_id", "congestion", "color", NULL};
+	std::vector<Agsym_t *> graph_syms, node_syms, edge_syms;
+
+	mytopology = topology_t();
+	mytopology.graph_name = agnameof(mygraph);
+	declare_dot_attrs(mygraph, AGRAPH, no_skip, &mytopology.graph_attrs, &graph_syms);
+	declare_dot_attrs(mygraph, AGNODE, no_skip, &mytopology.node_attrs, &node_syms);
+	declare_dot_attrs(mygraph, AGEDGE, edge_skip, &mytopology.edge_attrs, &edge_syms);
+	add_dot_attrs(mygraph, &mytopology.graph_attrs, &graph_syms);
+
+	/* Number the nodes, the hosts and the switches. The host ids follow the
+	 * same order get_namelist_from_graph used to return the host names in. */
+	for (n = agfstnode(mygraph); n != NULL; n = agnxtnode(mygraph, n)) {
+		std::string nodename = (std::string) agnameof(n);
+		nodeid_t node = mytopology.node_names.size();
+
+		mytopology.node_names.push_back(nodename);
+		mytopology.node_index[nodename] = node;
+		add_dot_attrs(n, &mytopology.node_attrs, &node_syms);
+		if (nodename.find('H', 0) == 0) {
+			mytopology.host_index.push_back(mytopology.host_node.size());
+			mytopology.host_node.push_back(node);
+			mytopology.switch_index.push_back(-1);
+		} else {
+			mytopology.host_index.push_back(-1);
+			mytopology.switch_index.push_back(mytopology.switch_node.size());
+			mytopology.switch_node.push_back(node);
+		}
+	}
+
+	/* Copy the out edges into CSR form, the position of an edge is its id */
+	mytopology.out_offset.reserve(mytopology.node_names.size() + 1);
+	mytopology.edge_head.reserve(agnedges(mygraph));
+	mytopology.edge_key.reserve(agnedges(mygraph));
+	mytopology.dst_kind.reserve(agnedges(mygraph));
+	mytopology.dst_offset.reserve(agnedges(mygraph) + 1);
+	for (n = agfstnode(mygraph); n != NULL; n = agnxtnode(mygraph, n)) {
+		mytopology.out_offset.push_back(mytopology.edge_head.size());
+		for (e = agfstout(mygraph, n); e; e = agnxtout(mygraph, e)) {
+			char *key = agnameof(e);
+			char *comment = agget(e, (char *) "comment");
+
+			mytopology.edge_head.push_back(mytopology.node_index[agnameof(aghead(e))]);
+			mytopology.edge_key.push_back((key != NULL) ? key : "");
+			encode_destinations((comment != NULL) ? comment : "");
+			add_dot_attrs(e, &mytopology.edge_attrs, &edge_syms);
+		}
+	}
+	mytopology.out_offset.push_back(mytopology.edge_head.size());
+	mytopology.dst_offset.push_back(mytopology.dst_data.size());
+
+	classify_links();
+}
+
+hostid_t get_host_id(const char *name) {
+	std::map<std::string, nodeid_t>::iterator it = mytopology.node_index.find(name);
+
+	if (it == mytopology.node_index.end())
+		return -1;
+	return mytopology.host_index[it->second];
+}
+
+void compile_forwarding_tables() {
+	nodeid_t node;
+	edgeid_t edgeid;
+	int num_nodes, num_hosts;
+
+	num_nodes = get_num_nodes();
+	num_hosts = get_num_hosts();
+
+	mytopology.fwd_offset.assign(num_nodes, -1);
+	mytopology.fwd_uniform.assign(num_nodes, -1);
+	mytopology.fwd_table.clear();
+
+	/* The old lookup used the first out edge (in agfstout order) whose
+	 * comment contained the destination, so an entry is only set if no
+	 * earlier edge of the same node claimed that destination already. */
+	std::vector<edgeid_t> row(num_hosts);
+	for (node = 0; node < num_nodes; node++) {
+		int i;
+
+		std::fill(row.begin(), row.end(), -1);
+		for (edgeid = mytopology.out_offset[node]; edgeid < mytopology.out_offset[node + 1]; edgeid++) {
+			long words = mytopology.dst_offset[edgeid + 1] - mytopology.dst_offset[edgeid];
+			const unsigned int *data = (words > 0) ? &mytopology.dst_data[mytopology.dst_offset[edgeid]] : NULL;
+			long k;
+
+			switch (mytopology.dst_kind[edgeid]) {
+			case DSTSET_WILDCARD:
+				for (i = 0; i < num_hosts; i++)
+					if (row[i] == -1) row[i] = edgeid;
+				break;
+			case DSTSET_INTERVALS:
+				for (k = 0; k < words; k += 2)
+					for (i = data[k]; i <= (int) data[k + 1]; i++)
+						if (row[i] == -1) row[i] = edgeid;
+				break;
+			case DSTSET_BITSET:
+				for (i = 0; i < num_hosts; i++)
+					if ((row[i] == -1) && ((data[i / 32] >> (i % 32)) & 1)) row[i] = edgeid;
+				break;
+			}
+		}
+
+		/* Nodes that forward everything over a single edge (or nothing at
+		 * all) do not need a row of their own */
+		for (i = 1; i < num_hosts; i++)
+			if (row[i] != row[0]) break;
+
+		if (i >= num_hosts) {
+			mytopology.fwd_uniform[node] = (num_hosts > 0) ? row[0] : -1;
+		} else {
+			mytopology.fwd_offset[node] = mytopology.fwd_table.size();
+			mytopology.fwd_table.insert(mytopology.fwd_table.end(), row.begin(), row.end());
+		}
+	}
+}
+
+std::string get_edge_comment(edgeid_t edgeid) {
+	long words = mytopology.dst_offset[edgeid + 1] - mytopology.dst_offset[edgeid];
+	const unsigned int *data = (words > 0) ? &mytopology.dst_data[mytopology.dst_offset[edgeid]] : NULL;
+	std::string comment;
+	hostid_t host;
+	long k;
+
+	/* the hosts are listed in host id order */
+	switch (mytopology.dst_kind[edgeid]) {
+	case DSTSET_WILDCARD:
+		return "*";
+	case DSTSET_INTERVALS:
+		for (k = 0; k < words; k += 2) {
+			for (host = data[k]; host <= (hostid_t) data[k + 1]; host++) {
+				if (!comment.empty()) comment += ", ";
+				comment += get_host_name(host);
+			}
+		}
+		break;
+	case DSTSET_BITSET:
+		for (host = 0; host < get_num_hosts(); host++) {
+			if (!((data[host / 32] >> (host % 32)) & 1)) continue;
+			if (!comment.empty()) comment += ", ";
+			comment += get_host_name(host);
+		}
+		break;
+	}
+	return comment;
+}
@@ -0,0 +1,140 @@
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "simulator.hpp"
+
+/* The dot attributes of the graph, of the nodes or of the edges, so that
+ * the annotated topology can be written out again after the cgraph object
+ * has been closed. Only the values that differ from the declared default
+ * are kept: the values of object i are value[offset[i] .. offset[i+1]-1],
+ * attr holds the attribute they belong to. */
+typedef struct {
+	std::vector<std::string> names;     /* attribute -> name */
+	std::vector<std::string> defaults;  /* attribute -> declared default */
+	std::vector<long> offset;           /* object -> first value, num objects + 1 entries */
+	std::vector<int> attr;
+	std::vector<std::string> value;
+} dot_attrs_t;
+
+/* The compiled topology is a snapshot of the fabric that is built once
+ * after the dot file has been read; the cgraph object is closed right
+ * afterwards. build_topology maps all nodes, hosts, switches and edges to
+ * dense ids and stores the out edges of all nodes in compressed sparse row
+ * form, so that the simulation itself only works on integers and flat
+ * arrays; names are only needed again when results are printed.
+ *
+ * The out edges of node v are the edge ids out_offset[v] .. out_offset[v+1]-1,
+ * in the order agfstout/agnxtout returned them. The edge ids are simply the
+ * CSR positions (this is the numbering tag_edges used to store in the
+ * edge_id attribute).
+ *
+ * The forwarding tables hold everything the route lookup needs in dense
+ * arrays, so that find_route does not have to look at the (huge) routing
+ * comments at all. */
+typedef struct {
+	std::string graph_name;
+	std::vector<std::string> node_names;     /* node id -> node name (agfstnode order) */
+	std::map<std::string, nodeid_t> node_index; /* node name -> node id */
+	std::vector<hostid_t> host_index;        /* node id -> host id, -1 for switches */
+	std::vector<nodeid_t> host_node;         /* host id -> node id */
+	std::vector<int> switch_index;           /* node id -> switch id, -1 for hosts */
+	std::vector<nodeid_t> switch_node;       /* switch id -> node id */
+
+	/* CSR adjacency and per edge attributes */
+	std::vector<edgeid_t> out_offset;        /* node id -> first out edge, num_nodes + 1 entries */
+	std::vector<nodeid_t> edge_head;         /* edge id -> node id of the head */
+	std::vector<std::string> edge_key;       /* edge id -> cgraph edge name (the port) */
+	std::vector<unsigned char> edge_tier;    /* edge id -> LINK_* */
+
+	/* All other dot attributes of the input. The routing comments of the
+	 * edges are not among them (see get_edge_comment), nor are the
+	 * attributes that write_graph_with_congestions sets itself. */
+	dot_attrs_t graph_attrs;                 /* one object, the graph */
+	dot_attrs_t node_attrs;                  /* node id -> attributes */
+	dot_attrs_t edge_attrs;                  /* edge id -> attributes */
+
+	/* The routing comment of every edge is parsed once while the graph is
+	 * read and kept as the set of destination host ids it lists, either as
+	 * sorted intervals (pairs of first and last host id) or as a bitset over
+	 * all host ids, whichever is smaller. The strings themselves are not
+	 * kept; get_edge_comment regenerates them for the dot output. */
+	std::vector<unsigned char> dst_kind;     /* edge id -> DSTSET_* */
+	std::vector<long> dst_offset;            /* edge id -> first word in dst_data, num_edges + 1 entries */
+	std::vector<unsigned int> dst_data;
+
+	/* Forwarding state: a node either sends all destinations over the same
+	 * out edge (e.g. hosts with a '*' comment) and stores that edge in
+	 * fwd_uniform, or it has its own row of num_hosts entries starting at
+	 * fwd_offset in fwd_table. An edge id of -1 means "no route". */
+	std::vector<long> fwd_offset;            /* node id -> row offset, -1 if uniform */
+	std::vector<edgeid_t> fwd_uniform;       /* node id -> edge id if uniform */
+	std::vector<edgeid_t> fwd_table;         /* rows of host id -> edge id */
+} topology_t;
+
+#define DSTSET_EMPTY     0
+#define DSTSET_WILDCARD  1  /* the comment is "*" */
+#define DSTSET_INTERVALS 2
+#define DSTSET_BITSET    3
+
+/* The tiers of the links: links from or to a host, links from a leaf
+ * switch (a switch with hosts attached) to another switch, and all other
+ * links between switches */
+#define LINK_HOST    0
+#define LINK_LEAF_UP 1
+#define LINK_SPINE   2
+#define LINK_TIERS   3
+
+/* prototypes */
+void build_topology(Agraph_t *mygraph);
+void compile_forwarding_tables();
+hostid_t get_host_id(const char *name);
+std::string get_edge_comment(edgeid_t edgeid);
+
+/* Returns the edge a packet for the host dst_host takes when it leaves the
+ * node with the id node, or -1 if there is no such edge */
+inline edgeid_t get_next_hop(topology_t *topo, nodeid_t node, hostid_t dst_host) {
+	long offset = topo->fwd_offset[node];
+
+	if (offset < 0)
+		return topo->fwd_uniform[node];
+	return topo->fwd_table[offset + dst_host];
+}
+
+/* globals */
+extern topology_t mytopology;
+
+inline const char *get_node_name(nodeid_t node) {
+	return mytopology.node_names[node].c_str();
+}
+
+inline const char *get_host_name(hostid_t host) {
+	return mytopology.node_names[mytopology.host_node[host]].c_str();
+}
+
+inline int get_num_nodes() {
+	return mytopology.node_names.size();
+}
+
+inline int get_num_hosts() {
+	return mytopology.host_node.size();
+}
+
+inline int get_num_switches() {
+	return mytopology.switch_node.size();
+}
+
+inline int get_num_edges() {
+	return mytopology.edge_head.size();
+}
+
+/* The node an edge leaves from, the edges are numbered by their tail */
+inline nodeid_t get_edge_tail(edgeid_t edgeid) {
+	return std::upper_bound(mytopology.out_offset.begin(), mytopology.out_offset.end(), edgeid)
+	       - mytopology.out_offset.begin() - 1;
+}
+
+#endif